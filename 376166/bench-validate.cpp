@@ -0,0 +1,146 @@
+/**
+ * @file   bench-validate.cpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Timing of the validation kernels of the timestamp-based engines (see
+ * 'validate.hpp') over read sets of growing sizes: runs of versioned locks
+ * as logged by TL2, read contiguously or gathered, and runs of version chain
+ * heads as logged by the multi-version engine. Each kernel is also checked
+ * against the scalar one, on a read set with one invalid word.
+**/
+
+// External headers
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Internal headers
+#include "macros.h"
+#include "validate.hpp"
+
+static size_t const min_words = 16;
+static size_t const max_words = (size_t) 1 << 16;
+static size_t const nbwordsperrun = (size_t) 1 << 24; // Number of words checked per measure
+
+static uint64_t const lock_bit = 1;    // Lock bit of a stripe (TL2) or of a cell (multi-version)
+static uint64_t const rv       = 1000; // Read version of the validating transaction
+
+/**
+ * @brief Version, as in the multi-version engine.
+ */
+struct version {
+    uint64_t ts;
+    struct version* next;
+};
+
+/**
+ * @brief Kernel under measure, for lock words or for version chain heads.
+ */
+struct kernel {
+    char const* name;
+    validate_fn direct;            // Kernel for lock words, or 'NULL'
+    validate_indirect_fn indirect; // Kernel for version chain heads, or 'NULL'
+};
+
+// -------------------------------------------------------------------------- //
+
+/** Run a kernel once over a read set.
+ * @param kernel Kernel to run
+ * @param words  Read set
+ * @param count  Number of words
+ * @param stride Distance between two words (in words)
+ * @return Index of the first invalid word, 'count' if none
+**/
+static size_t run(struct kernel const& kernel, std::atomic<uint64_t> const* words, size_t count, size_t stride) {
+    if (kernel.direct)
+        return kernel.direct(words, count, stride, lock_bit, rv << 1);
+    return kernel.indirect(words, count, stride, lock_bit, lock_bit, offsetof(struct version, ts), rv);
+}
+
+/** Time a kernel over read sets of growing sizes, and check it against its scalar counterpart.
+ * @param kernel Kernel to time
+ * @param scalar Scalar counterpart
+ * @param words  Read set, of 'max_words * stride' words
+ * @param stride Distance between two words (in words)
+ * @param bad    Read set with one invalid word, of the same size
+ * @return Whether the kernel agreed with the scalar one
+**/
+static bool measure(struct kernel const& kernel, struct kernel const& scalar, std::vector<std::atomic<uint64_t>>& words, size_t stride, std::vector<std::atomic<uint64_t>>& bad) {
+    for (size_t count = min_words; count <= max_words; count *= 4) {
+        for (size_t end: {count, count - 1, count / 2 + 1}) {
+            if (run(kernel, bad.data(), end, stride) != run(scalar, bad.data(), end, stride)) {
+                std::cerr << "ERROR: kernel '" << kernel.name << "' disagrees with the scalar one (" << end << " words, stride " << stride << ")" << std::endl;
+                return false;
+            }
+        }
+        size_t reps = nbwordsperrun / count;
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < reps; ++i)
+            found += run(kernel, words.data(), count, stride);
+        auto duration = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (found != reps * count) {
+            std::cerr << "ERROR: kernel '" << kernel.name << "' rejected a valid read set" << std::endl;
+            return false;
+        }
+        std::cout << "validate " << kernel.name << " stride " << stride << ", " << count << " words: " << duration / (reps * count) << " ns/word" << std::endl;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Program entry point.
+ * @return Program return code
+**/
+int main() {
+    std::minstd_rand engine{1};
+    std::uniform_int_distribution<uint64_t> older{0, rv};
+    std::vector<struct version> versions(max_words);
+    for (auto& v: versions)
+        v = version{older(engine), NULL};
+
+    struct kernel const scalar{"scalar", validate_scalar, NULL};
+    struct kernel const indirect_scalar{"indirect-scalar", NULL, validate_indirect_scalar};
+    std::vector<std::pair<struct kernel, struct kernel>> kernels{{scalar, scalar}, {indirect_scalar, indirect_scalar}};
+#if defined(__x86_64__)
+    if (validate_has_avx2()) {
+        kernels.push_back({kernel{"avx2", validate_avx2, NULL}, scalar});
+        kernels.push_back({kernel{"indirect-avx2", NULL, validate_indirect_avx2}, indirect_scalar});
+    }
+#endif
+
+    for (size_t stride: {1, 2}) {
+        std::vector<std::atomic<uint64_t>> locks(max_words * stride), bad_locks(max_words * stride);
+        std::vector<std::atomic<uint64_t>> heads(max_words * stride), bad_heads(max_words * stride);
+        for (size_t i = 0; i < max_words; ++i) {
+            // Unlocked stripes at versions up to the read version, one in 4 cells never written
+            locks[i * stride].store(older(engine) << 1, std::memory_order_relaxed);
+            heads[i * stride].store(i % 4 == 0 ? 0 : (uintptr_t) &versions[i], std::memory_order_relaxed);
+            bad_locks[i * stride].store(locks[i * stride].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bad_heads[i * stride].store(heads[i * stride].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        // A newer stripe, a locked cell and a newer cell, in the second half of the smallest read set
+        static struct version newer{rv + 1, NULL};
+        bad_locks[(min_words / 2 + 1) * stride].store((rv + 1) << 1, std::memory_order_relaxed);
+        bad_heads[(min_words / 2 + 2) * stride].store(heads[(min_words / 2 + 2) * stride].load(std::memory_order_relaxed) | lock_bit, std::memory_order_relaxed);
+        bad_heads[(min_words / 2 + 3) * stride].store((uintptr_t) &newer, std::memory_order_relaxed);
+        for (auto& [kernel, reference]: kernels) {
+            bool ok = kernel.direct ? measure(kernel, reference, locks, stride, bad_locks) : measure(kernel, reference, heads, stride, bad_heads);
+            if (unlikely(!ok))
+                return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file   bench.cpp
+ * @author []
+ *
+ * @section LICENSE
+ *
+ * Copyright © 2018-2019 Sébastien Rouault.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version. Please see https://gnu.org/licenses/gpl.html
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Timing of short transactions (transfers between two accounts) and long ones
+ * (read-only scans of every account) through the transactional memory
+ * interface, to compare the layouts the library can be built with.
+**/
+
+// External headers
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Internal headers
+#include "tm.hpp"
+
+using Balance = intptr_t;
+
+static size_t const nbaccounts  = 4096;
+static size_t const nbshortperwrk = 200000;
+static size_t const nblongperwrk  = 2000;
+static Balance const init_balance = 100;
+
+#ifdef LAYOUT_AOS
+static char const* const layout = "AoS";
+#else
+static char const* const layout = "SoA";
+#endif
+
+static shared_t tm;
+
+// -------------------------------------------------------------------------- //
+
+/** Run the given transaction body until it commits.
+ * @param is_ro Whether the transaction is read-only
+ * @param body  Transaction body, returning whether the transaction can continue
+**/
+template<class Func> static void transactional(bool is_ro, Func&& body) {
+    while (true) {
+        tx_t tx = tm_begin(tm, is_ro);
+        if (tx == invalid_tx) {
+            ::std::cerr << "ERROR: unable to begin a transaction" << ::std::endl;
+            ::std::exit(1);
+        }
+        if (!body(tx))
+            continue; // Aborted
+        if (tm_end(tm, tx))
+            return;
+    }
+}
+
+/** Short transaction: transfer one unit between two random accounts.
+ * @param engine Random engine of the calling thread
+**/
+static void short_tx(::std::minstd_rand& engine) {
+    ::std::uniform_int_distribution<size_t> account{0, nbaccounts - 1};
+    size_t src = account(engine);
+    size_t dst = account(engine);
+    Balance* accounts = (Balance*) tm_start(tm);
+    transactional(false, [&](tx_t tx) {
+        Balance src_val, dst_val;
+        if (!tm_read(tm, tx, &accounts[src], sizeof(Balance), &src_val)
+         || !tm_read(tm, tx, &accounts[dst], sizeof(Balance), &dst_val))
+            return false;
+        if (src == dst || src_val <= 0)
+            return true;
+        --src_val;
+        ++dst_val;
+        return tm_write(tm, tx, &src_val, sizeof(Balance), &accounts[src])
+            && tm_write(tm, tx, &dst_val, sizeof(Balance), &accounts[dst]);
+    });
+}
+
+/** Long transaction: read-only scan of every account.
+ * @param engine Random engine of the calling thread (unused)
+**/
+static void long_tx(::std::minstd_rand&) {
+    static thread_local ::std::vector<Balance> all(nbaccounts);
+    Balance* accounts = (Balance*) tm_start(tm);
+    transactional(true, [&](tx_t tx) {
+        return tm_read(tm, tx, accounts, nbaccounts * sizeof(Balance), all.data());
+    });
+}
+
+/** Time the given transaction on several threads.
+ * @param name      Name of the transaction
+ * @param func      Transaction to run
+ * @param nbtxperwrk Number of transactions per thread
+ * @param nbworkers Number of threads
+**/
+template<class Func> static void measure(char const* name, Func func, size_t nbtxperwrk, size_t nbworkers) {
+    auto start = ::std::chrono::steady_clock::now();
+    ::std::vector<::std::thread> threads;
+    for (size_t i = 0; i < nbworkers; ++i) {
+        threads.emplace_back([=]() {
+            ::std::minstd_rand engine{static_cast<unsigned int>(i + 1)};
+            for (size_t j = 0; j < nbtxperwrk; ++j)
+                func(engine);
+        });
+    }
+    for (auto&& thread: threads)
+        thread.join();
+    auto duration = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(::std::chrono::steady_clock::now() - start).count();
+    ::std::cout << layout << " " << name << ": " << duration / static_cast<decltype(duration)>(nbtxperwrk * nbworkers) << " ns/tx" << ::std::endl;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Program entry point.
+ * @param argc Arguments count
+ * @param argv Arguments values
+ * @return Program return code
+**/
+int main(int argc, char** argv) {
+    size_t const nbworkers = argc > 1 ? ::std::strtoul(argv[1], nullptr, 10) : 4;
+
+    // Init shared memory
+    tm = tm_create(nbaccounts * sizeof(Balance), sizeof(Balance));
+    if (tm == invalid_shared) {
+        ::std::cerr << "ERROR: unable to create shared memory" << ::std::endl;
+        return 1;
+    }
+    transactional(false, [&](tx_t tx) {
+        Balance* accounts = (Balance*) tm_start(tm);
+        for (size_t i = 0; i < nbaccounts; ++i) {
+            if (!tm_write(tm, tx, &init_balance, sizeof(Balance), &accounts[i]))
+                return false;
+        }
+        return true;
+    });
+
+    measure("short_tx", short_tx, nbshortperwrk, nbworkers);
+    measure("long_tx", long_tx, nblongperwrk, nbworkers);
+    tm_destroy(tm);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "contention.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+static const size_t cm_spins       = 64; // Number of polls before yielding the processor
+static const size_t cm_round_polls = 64; // Number of polls of a round of 'cm_karma', and of the first one of 'cm_polka'
+static const unsigned int cm_max_shift = 10; // Cap on the exponent of the backoff delays and of the rounds of 'cm_polka'
+
+static std::atomic<uint64_t> cm_clock{0}; // Timestamps of the first attempts, for 'cm_greedy'
+
+/** Hint the processor that we are spin-waiting.
+**/
+static inline void spin_pause() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/** Draw a random number for a backoff delay (xorshift).
+ * @param self Contention state of the calling thread
+ * @return Random number
+**/
+static uint64_t cm_random(struct cm_state* self) {
+    uint64_t x = self->seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self->seed = x;
+    return x;
+}
+
+/** Get the priority of the running attempt of a transaction.
+ * @param policy Contention management policy
+ * @param state  Contention state of the transaction
+ * @return Priority, the highest the most likely to win
+**/
+static uint64_t cm_priority(int policy, struct cm_state* state) {
+    switch (policy) {
+    case cm_greedy:
+        return state->base.load(std::memory_order_relaxed);
+    case cm_long:
+        return state->work.load(std::memory_order_relaxed);
+    default:
+        return state->base.load(std::memory_order_relaxed) + state->work.load(std::memory_order_relaxed);
+    }
+}
+
+/** Tell whether the given policy may kill running attempts.
+ * @param policy Contention management policy
+ * @return Whether attempts can be killed
+**/
+static inline bool cm_kills(int policy) {
+    return policy != cm_suicide && policy != cm_backoff;
+}
+
+int cm_policy_of() {
+    static char const* const names[] = {"suicide", "backoff", "karma", "polka", "greedy", "long"};
+    char const* env = getenv("TM_CONTENTION");
+    if (env) {
+        for (int policy = 0; policy < (int) (sizeof(names) / sizeof(names[0])); ++policy) {
+            if (strcmp(env, names[policy]) == 0)
+                return policy;
+        }
+    }
+    return cm_suicide;
+}
+
+void cm_init(struct cm_state* self) {
+    self->status.store(0, std::memory_order_relaxed);
+    self->work.store(0, std::memory_order_relaxed);
+    self->base.store(0, std::memory_order_relaxed);
+    self->aborts = 0;
+    self->seed   = (uintptr_t) self | 1; // Any non-zero seed
+}
+
+void cm_delay(int policy, struct cm_state* self) {
+    if (policy != cm_backoff || self->aborts == 0)
+        return;
+    unsigned int shift = self->aborts < cm_max_shift ? self->aborts : cm_max_shift;
+    size_t delay = cm_random(self) & ((cm_round_polls << shift) - 1);
+    for (size_t poll = 0; poll < delay; ++poll)
+        cm_pause(poll);
+}
+
+void cm_begin(int policy, struct cm_state* self) {
+    if (policy == cm_greedy && self->base.load(std::memory_order_relaxed) == 0) // First attempt: the older, the higher
+        self->base.store(~cm_clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+    self->work.store(0, std::memory_order_relaxed);
+    // Published along with the first registration of the attempt
+    uint64_t status = self->status.load(std::memory_order_relaxed) & ~(cm_status_running | cm_status_killed);
+    self->status.store((status + cm_status_attempt) | cm_status_running, std::memory_order_relaxed);
+}
+
+bool cm_commit(int policy, struct cm_state* self) {
+    uint64_t status = self->status.load(std::memory_order_relaxed);
+    if (cm_kills(policy)) {
+        if (status & cm_status_killed)
+            return false;
+        if (!self->status.compare_exchange_strong(status, status & ~cm_status_running, std::memory_order_acq_rel, std::memory_order_relaxed))
+            return false; // Killed meanwhile
+    } else {
+        self->status.store(status & ~(cm_status_running | cm_status_killed), std::memory_order_release); // A kill is only a hint then
+    }
+    self->base.store(0, std::memory_order_relaxed);
+    self->aborts = 0;
+    return true;
+}
+
+void cm_abort(int policy, struct cm_state* self) {
+    if (policy == cm_karma || policy == cm_polka) // Keep the work done
+        self->base.store(self->base.load(std::memory_order_relaxed) + self->work.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ++self->aborts;
+    // Released after the registrations, for the waiting enemies
+    uint64_t status = self->status.load(std::memory_order_relaxed);
+    self->status.store(status & ~(cm_status_running | cm_status_killed), std::memory_order_release);
+}
+
+int cm_resolve(int policy, struct cm_state* self, struct cm_state* enemy, unsigned int round, uint64_t* status) {
+    *status = enemy->status.load(std::memory_order_acquire);
+    if (!(*status & cm_status_running) || !cm_kills(policy))
+        return cm_abort_self;
+    uint64_t mine = cm_priority(policy, self);
+    uint64_t theirs = cm_priority(policy, enemy);
+    bool wins = mine > theirs || (mine == theirs && self < enemy);
+    switch (policy) {
+    case cm_greedy:
+        return wins ? cm_kill_enemy : cm_wait;
+    case cm_long:
+        return wins ? cm_kill_enemy : cm_abort_self;
+    default: // Karma and Polka
+        return wins || round > theirs - mine ? cm_kill_enemy : cm_wait;
+    }
+}
+
+bool cm_kill(struct cm_state* enemy, uint64_t status) {
+    uint64_t killed = status | cm_status_killed;
+    // Also done if another transaction killed the same attempt first
+    return enemy->status.compare_exchange_strong(status, killed, std::memory_order_acq_rel, std::memory_order_relaxed) || status == killed;
+}
+
+size_t cm_patience(int policy, unsigned int round) {
+    switch (policy) {
+    case cm_greedy:
+        return SIZE_MAX;
+    case cm_karma:
+        return cm_round_polls;
+    case cm_polka:
+        return cm_round_polls << (round < cm_max_shift ? round : cm_max_shift);
+    default:
+        return 0;
+    }
+}
+
+void cm_pause(size_t poll) {
+    if (poll < cm_spins) {
+        spin_pause();
+    } else {
+        std::this_thread::yield();
+    }
+}
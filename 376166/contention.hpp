@@ -0,0 +1,142 @@
+#ifndef CONTENTION_H
+#define CONTENTION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Contention management of the read-write transactions.
+ *
+ * A read-write transaction that finds a word registered by a single other
+ * running one (its enemy) asks the policy of the region, selected in
+ * 'tm_create' by 'TM_CONTENTION', whether to abort itself, to wait for the
+ * enemy to release the word, or to kill the enemy (which then aborts at its
+ * next access or at its end) and wait for it to release the word:
+ * - 'cm_suicide' ("suicide", unset or unknown): abort itself;
+ * - 'cm_backoff' ("backoff"): abort itself, and delay the next begin of its
+ *   thread by a random time, exponential in the number of consecutive aborts;
+ * - 'cm_karma' ("karma"): the priority is the number of words registered,
+ *   over the aborted attempts too; wait for a fixed time per round, and kill
+ *   the enemy once the rounds make up for the difference of priorities;
+ * - 'cm_polka' ("polka"): as 'cm_karma', with rounds exponentially longer;
+ * - 'cm_greedy' ("greedy"): the priority is the age of the first attempt;
+ *   kill a younger enemy, and wait for an older one;
+ * - 'cm_long' ("long"): the transaction that registered more words in its
+ *   attempt wins, the other one aborts itself.
+ * Priorities are broken by the address of the contention state, so that a
+ * transaction only waits for another one it killed, or that is older.
+ *
+ * A transaction that committed keeps its registrations until the epoch ends,
+ * which cannot happen while another one waits: its enemies abort themselves.
+ */
+static const int cm_suicide = 0;
+static const int cm_backoff = 1;
+static const int cm_karma   = 2;
+static const int cm_polka   = 3;
+static const int cm_greedy  = 4;
+static const int cm_long    = 5;
+
+// Layout of 'cm_state::status', from the least significant bit
+static const uint64_t cm_status_running = 1; // An attempt is running
+static const uint64_t cm_status_killed  = 2; // The running attempt was killed
+static const uint64_t cm_status_attempt = 4; // Unit of the attempt number
+
+// Decisions of 'cm_resolve'
+static const int cm_abort_self  = 0;
+static const int cm_wait        = 1;
+static const int cm_kill_enemy  = 2;
+
+/**
+ * @brief Contention state of the read-write transactions of one thread.
+ */
+struct cm_state {
+    std::atomic<uint64_t> status; // Attempt number, killed and running flags (see 'cm_status_*' units)
+    std::atomic<uint64_t> work;   // Number of words registered by the running attempt
+    std::atomic<uint64_t> base;   // Priority carried over from the aborted attempts (inverted timestamp of the first one for 'cm_greedy')
+    uint64_t aborts;              // Number of consecutive aborts (owner thread only)
+    uint64_t seed;                // State of the backoff random generator (owner thread only)
+};
+
+/** Get the contention management policy asked for by the environment.
+ * @return Policy (see 'cm_*' policies)
+**/
+int cm_policy_of();
+
+/** Initialize the given contention state.
+ * @param self Contention state to initialize
+**/
+void cm_init(struct cm_state* self);
+
+/** Wait for the backoff delay of the policy before a new attempt.
+ * @param policy Contention management policy
+ * @param self   Contention state of the calling thread
+**/
+void cm_delay(int policy, struct cm_state* self);
+
+/** Start a new attempt, once in the epoch it runs in (the registrations of the previous attempt last until the previous epoch ends).
+ * @param policy Contention management policy
+ * @param self   Contention state of the calling thread
+**/
+void cm_begin(int policy, struct cm_state* self);
+
+/** End the running attempt, unless it was killed.
+ * @param policy Contention management policy
+ * @param self   Contention state of the calling thread
+ * @return Whether the attempt can commit, otherwise it must abort
+**/
+bool cm_commit(int policy, struct cm_state* self);
+
+/** End the running attempt as aborted, once it released its registrations.
+ * @param policy Contention management policy
+ * @param self   Contention state of the calling thread
+**/
+void cm_abort(int policy, struct cm_state* self);
+
+/** Tell whether the running attempt of the calling thread was killed.
+ * @param self Contention state of the calling thread
+ * @return Whether the attempt must abort
+**/
+static inline bool cm_killed(struct cm_state* self) {
+    return self->status.load(std::memory_order_relaxed) & cm_status_killed;
+}
+
+/** Decide how to handle a conflict with the given enemy.
+ * @param policy Contention management policy
+ * @param self   Contention state of the calling thread
+ * @param enemy  Contention state of the enemy
+ * @param round  Number of previous rounds of this conflict
+ * @param status Status of the enemy the decision is based on (output)
+ * @return Decision (see 'cm_abort_self', 'cm_wait' and 'cm_kill_enemy')
+**/
+int cm_resolve(int policy, struct cm_state* self, struct cm_state* enemy, unsigned int round, uint64_t* status);
+
+/** Kill the attempt of the enemy with the given status.
+ * @param enemy  Contention state of the enemy
+ * @param status Status of the enemy, as returned by 'cm_resolve'
+ * @return Whether the attempt is killed, otherwise it ended meanwhile
+**/
+bool cm_kill(struct cm_state* enemy, uint64_t status);
+
+/** Tell whether the attempt of the enemy with the given status is over (committed or aborted).
+ * @param enemy  Contention state of the enemy
+ * @param status Status of the enemy, as returned by 'cm_resolve'
+ * @return Whether the attempt is over
+**/
+static inline bool cm_over(struct cm_state* enemy, uint64_t status) {
+    return (enemy->status.load(std::memory_order_acquire) | cm_status_killed) != (status | cm_status_killed);
+}
+
+/** Get the number of polls to wait for an enemy in a round, if not killed.
+ * @param policy Contention management policy
+ * @param round  Number of previous rounds of the conflict
+ * @return Number of polls, 'SIZE_MAX' to wait until the enemy is over
+**/
+size_t cm_patience(int policy, unsigned int round);
+
+/** Pause between two polls of a wait.
+ * @param poll Number of previous polls of the wait
+**/
+void cm_pause(size_t poll);
+
+#endif /* CONTENTION_H */
@@ -0,0 +1,156 @@
+/**
+ * @file   dispatch.cpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Exported interface: each shared memory region is bound at creation to one
+ * of the engines built into the library, chosen by 'TM_ENGINE' ("batcher",
+ * the default, "rwlock", "tl2", "norec" or "mvcc"), and every call forwards
+ * to it through the function table of the region, with a single indirect
+ * call. Only this interface is shared: each engine keeps its own segment
+ * allocator, addressing and statistics, and its own freeing discipline (the
+ * "rwlock" engine frees a segment at once, as no other transaction runs
+ * alongside a writer, where the others defer it to their commit or epoch).
+**/
+
+// External headers
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Internal headers
+#include "engines.hpp"
+#include "macros.h"
+
+/**
+ * @brief Function table of an engine.
+ */
+struct engine {
+    char const* name; // Name in 'TM_ENGINE'
+    decltype(&dualvers::tm_create)  create;
+    decltype(&dualvers::tm_destroy) destroy;
+    decltype(&dualvers::tm_start)   start;
+    decltype(&dualvers::tm_size)    size;
+    decltype(&dualvers::tm_align)   align;
+    decltype(&dualvers::tm_begin)   begin;
+    decltype(&dualvers::tm_end)     end;
+    decltype(&dualvers::tm_read)    read;
+    decltype(&dualvers::tm_write)   write;
+    decltype(&dualvers::tm_alloc)   alloc;
+    decltype(&dualvers::tm_free)    free;
+};
+
+#define ENGINE_TABLE(name, ns) \
+    {name, ns::tm_create, ns::tm_destroy, ns::tm_start, ns::tm_size, ns::tm_align, ns::tm_begin, ns::tm_end, ns::tm_read, ns::tm_write, ns::tm_alloc, ns::tm_free}
+
+static struct engine const engines[] = { // The first one is the default
+    ENGINE_TABLE("batcher", dualvers),
+    ENGINE_TABLE("rwlock",  rwlock),
+    ENGINE_TABLE("tl2",     tl2),
+    ENGINE_TABLE("norec",   norec),
+    ENGINE_TABLE("mvcc",    mvcc),
+};
+
+#undef ENGINE_TABLE
+
+/**
+ * @brief Shared memory region of the chosen engine, with a copy of its table.
+ */
+struct instance {
+    struct engine ops; // Function table of the engine
+    shared_t region;   // Region of the engine
+};
+
+// -------------------------------------------------------------------------- //
+
+/** Get the engine asked for by the environment, printing the choice on first use.
+ * @return Engine, the default one if unset or unknown
+**/
+static struct engine const* engine_of() {
+    static std::atomic<bool> printed{false};
+    struct engine const* engine = &engines[0];
+    char const* env = getenv("TM_ENGINE");
+    if (env) {
+        for (auto& candidate: engines) {
+            if (strcmp(env, candidate.name) == 0)
+                engine = &candidate;
+        }
+    }
+    if (!printed.exchange(true, std::memory_order_relaxed))
+        fprintf(stderr, "tm: engine '%s'\n", engine->name);
+    return engine;
+}
+
+// -------------------------------------------------------------------------- //
+// Exported interface, documented along the engines (e.g. in 'tm.cpp')
+
+shared_t tm_create(size_t size, size_t align) noexcept {
+    struct instance* inst = new (std::nothrow) struct instance;
+    if (unlikely(!inst))
+        return invalid_shared;
+    inst->ops    = *engine_of();
+    inst->region = inst->ops.create(size, align);
+    if (unlikely(inst->region == invalid_shared)) {
+        delete inst;
+        return invalid_shared;
+    }
+    return inst;
+}
+
+void tm_destroy(shared_t shared) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    inst->ops.destroy(inst->region);
+    delete inst;
+}
+
+void* tm_start(shared_t shared) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.start(inst->region);
+}
+
+size_t tm_size(shared_t shared) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.size(inst->region);
+}
+
+size_t tm_align(shared_t shared) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.align(inst->region);
+}
+
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.begin(inst->region, is_ro);
+}
+
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.end(inst->region, tx);
+}
+
+bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.read(inst->region, tx, source, size, target);
+}
+
+bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.write(inst->region, tx, source, size, target);
+}
+
+Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.alloc(inst->region, tx, size, target);
+}
+
+bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
+    struct instance* inst = (struct instance*) shared;
+    return inst->ops.free(inst->region, tx, target);
+}
@@ -1,31 +1,145 @@
 #include "dual-vers.hpp"
 
-::std::atomic_int counter, remaining;
-::std::atomic<bool> sleep_task{false};
-std::vector<pthread_t> blocked_pthread;
-
-void enter_epoch() {
-    pthread_t current_pthread;
-    if (remaining) {
-        blocked_pthread.push_back(current_pthread);
-        sleep_task.wait(false);
-    }
-    else {
-        remaining = 1;
+#include "macros.h"
+
+// Layout of 'batcher::state', from the least significant bit
+static const uint64_t batcher_blocked   = (uint64_t) 1;         // Unit of the blocked count (16 bits)
+static const uint64_t batcher_remaining = (uint64_t) 1 << 16;   // Unit of the remaining count (16 bits)
+static const uint64_t batcher_readers   = (uint64_t) 1 << 32;   // Unit of the read-only count (16 bits)
+static const uint64_t batcher_closing   = (uint64_t) 1 << 48;   // Epoch-end work in progress
+static const uint64_t batcher_serial_wait = (uint64_t) 1 << 49; // A serial transaction waits for the next epoch
+static const uint64_t batcher_serial_run  = (uint64_t) 1 << 50; // The running epoch is a serial transaction's
+static const uint64_t batcher_epoch     = (uint64_t) 1 << 51;   // Unit of the epoch number (13 bits)
+static const uint64_t batcher_count_mask = batcher_remaining - 1;
+
+static const int batcher_spins = 128; // Number of polls before parking
+
+static inline uint64_t blocked_of(uint64_t state) {
+    return state & batcher_count_mask;
+}
+
+static inline uint64_t remaining_of(uint64_t state) {
+    return (state / batcher_remaining) & batcher_count_mask;
+}
+
+static inline uint64_t readers_of(uint64_t state) {
+    return (state / batcher_readers) & batcher_count_mask;
+}
+
+static inline uint64_t epoch_of(uint64_t state) {
+    return state / batcher_epoch;
+}
+
+/** Hint the processor that we are spin-waiting.
+**/
+static inline void spin_pause() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/** Wait until the epoch number moves past the given one.
+ * @param batcher Batcher to wait on
+ * @param epoch   Epoch number to wait the end of
+**/
+static void wait_epoch(struct batcher* batcher, uint64_t epoch) {
+    for (int spins = 0;; ++spins) {
+        // Read before the state: if the epoch ends after, 'ends' moves too
+        uint32_t ends = batcher->ends.load(std::memory_order_acquire);
+        if (epoch_of(batcher->state.load(std::memory_order_acquire)) != epoch)
+            return;
+        if (spins < batcher_spins) {
+            spin_pause();
+        } else {
+            batcher->ends.wait(ends, std::memory_order_acquire);
+        }
     }
 }
 
-void leave_epoch() {
-    remaining --;
-    if (!remaining) {
-        counter ++;
-        remaining = blocked_pthread.size();
-        for (auto pthread_: blocked_pthread) {
-            sleep_task.notify_all();
+void batcher_init(struct batcher* batcher) {
+    batcher->state.store(0, std::memory_order_relaxed);
+    batcher->ends.store(0, std::memory_order_relaxed);
+}
+
+uint64_t get_epoch(struct batcher* batcher) {
+    return epoch_of(batcher->state.load(std::memory_order_acquire));
+}
+
+void enter_epoch(struct batcher* batcher, bool is_ro) {
+    uint64_t state = batcher->state.load(std::memory_order_relaxed);
+    if (is_ro) {
+        // Join the running epoch right away, unless it is closing, serial, or
+        // other transactions wait for the next one (so readers cannot starve them)
+        while (true) {
+            if (!(state & (batcher_closing | batcher_serial_wait | batcher_serial_run)) && blocked_of(state) == 0) {
+                if (batcher->state.compare_exchange_weak(state, state + batcher_readers, std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+            } else {
+                wait_epoch(batcher, epoch_of(state));
+                state = batcher->state.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    while (true) {
+        if (remaining_of(state) == 0 && readers_of(state) == 0 && !(state & batcher_closing)) {
+            if (batcher->state.compare_exchange_weak(state, state + batcher_remaining, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        } else if (batcher->state.compare_exchange_weak(state, state + batcher_blocked, std::memory_order_relaxed)) {
+            break;
         }
-        blocked_pthread.clear();
     }
-    else {
-        remaining = 1;
+    // The thread opening the next epoch counts us in the remaining count before
+    // bumping the epoch, unless it opens it to a serial transaction alone
+    while (true) {
+        wait_epoch(batcher, epoch_of(state));
+        state = batcher->state.load(std::memory_order_acquire);
+        if (!(state & batcher_serial_run))
+            return;
     }
-}
\ No newline at end of file
+}
+
+void enter_serial(struct batcher* batcher, void (*drain)(void*), void* arg) {
+    uint64_t state = batcher->state.load(std::memory_order_relaxed);
+    while (true) {
+        if (remaining_of(state) == 0 && readers_of(state) == 0 && !(state & batcher_closing)) {
+            if (batcher->state.compare_exchange_weak(state, state + batcher_remaining + batcher_serial_run, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        } else if (batcher->state.compare_exchange_weak(state, state | batcher_serial_wait, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (drain)
+        drain(arg);
+    // The thread opening the next epoch counts us alone in the remaining count before bumping the epoch
+    wait_epoch(batcher, epoch_of(state));
+}
+
+bool leave_epoch(struct batcher* batcher, bool is_ro) {
+    uint64_t unit = is_ro ? batcher_readers : batcher_remaining;
+    uint64_t state = batcher->state.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = state - unit;
+        if (remaining_of(next) == 0 && readers_of(next) == 0)
+            next |= batcher_closing;
+    } while (!batcher->state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+    return next & batcher_closing;
+}
+
+void end_epoch(struct batcher* batcher) {
+    uint64_t state = batcher->state.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        if (state & batcher_serial_wait) { // The blocked transactions wait for the serial one
+            next = (epoch_of(state) + 1) * batcher_epoch + batcher_serial_run + batcher_remaining + blocked_of(state);
+        } else {
+            next = (epoch_of(state) + 1) * batcher_epoch + blocked_of(state) * batcher_remaining;
+        }
+    } while (!batcher->state.compare_exchange_weak(state, next, std::memory_order_release, std::memory_order_relaxed));
+    // Only ever moves forward, whatever the order in which leaders of
+    // successive epochs get there
+    batcher->ends.fetch_add(1, std::memory_order_release);
+    // Wakes both the blocked read-write transactions and the read-only ones
+    // waiting for the closing epoch (no system call if nobody is parked)
+    batcher->ends.notify_all();
+}
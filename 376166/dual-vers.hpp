@@ -1,9 +1,73 @@
 #ifndef DUAL_VERS_H
 #define DUAL_VERS_H
 
-#include <pthread.h>
-#include <stdbool.h>
 #include <atomic>
-#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Batcher, letting transactions run by epochs.
+ *
+ * A transaction enters the current epoch if no epoch is running, otherwise it
+ * blocks until the next one. The last transaction leaving an epoch is handed
+ * the (exclusive) epoch-end work, and then opens the next epoch to every
+ * transaction that blocked meanwhile.
+ *
+ * Read-only transactions only ever read the readable copies, which do not
+ * change until the epoch ends: they join the running epoch right away and are
+ * counted apart, so the epoch cannot end under them. They only wait when the
+ * epoch is closing, or when read-write transactions already wait for the next
+ * epoch (so a stream of readers cannot starve writers).
+ *
+ * A serial transaction gets an epoch of its own: it enters right away if no
+ * epoch is running, otherwise it flags the running epoch, which then admits
+ * no more transactions (read-only ones included), and the end of that epoch
+ * opens the next one to it alone (the blocked transactions wait one more).
+ * At most one serial transaction may wait at a time.
+ *
+ * The whole state is packed in one atomic word, so entering and leaving cost
+ * one CAS each. Blocked transactions spin for a while, then park on 'ends'
+ * (a futex-backed 'std::atomic::wait'), which the last transaction bumps and
+ * wakes once per epoch.
+ */
+struct batcher {
+    std::atomic<uint64_t> state; // Epoch number, closing flag, read-only, remaining and blocked counts (see 'batcher_*' units)
+    std::atomic<uint32_t> ends;  // Count of ended epochs (modulo 2^32), for blocked transactions to wait on
+};
+
+/** Initialize the given batcher.
+ * @param batcher Batcher to initialize
+**/
+void batcher_init(struct batcher* batcher);
+
+/** Return the current epoch number.
+ * @param batcher Batcher to query
+ * @return Current epoch number
+**/
+uint64_t get_epoch(struct batcher* batcher);
+
+/** Enter the current epoch, or wait for the next one.
+ * @param batcher Batcher to enter
+ * @param is_ro   Whether the entering transaction is read-only
+**/
+void enter_epoch(struct batcher* batcher, bool is_ro);
+
+/** Enter an epoch alone, waiting for the running one to end if any.
+ * @param batcher Batcher to enter
+ * @param drain   Function called once the running epoch is flagged, if the caller has to wait, to hurry the epoch's end (optional)
+ * @param arg     Argument to 'drain'
+**/
+void enter_serial(struct batcher* batcher, void (*drain)(void*), void* arg);
+
+/** Leave the current epoch.
+ * @param batcher Batcher to leave
+ * @param is_ro   Whether the leaving transaction is read-only (a serial one is not)
+ * @return Whether the caller was the last one, and must then run the epoch-end work followed by 'end_epoch'
+**/
+bool leave_epoch(struct batcher* batcher, bool is_ro);
+
+/** Close the current epoch and open the next one, waking up the blocked transactions.
+ * @param batcher Batcher whose epoch-end work is done
+**/
+void end_epoch(struct batcher* batcher);
 
 #endif /* DUAL_VERS_H */
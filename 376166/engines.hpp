@@ -0,0 +1,39 @@
+#ifndef ENGINES_H
+#define ENGINES_H
+
+#include "tm.hpp"
+
+/**
+ * @brief Engines built into the library, each in its own namespace.
+ *
+ * Each engine implements the whole interface of 'tm.hpp' in its namespace:
+ * 'dualvers' ('tm.cpp', the dual-versioned engine behind a batcher),
+ * 'rwlock' ('rwlock.cpp'), and the engines of the other libraries of the
+ * repository, compiled here with 'TM_ENGINE' set to their namespace ('tl2',
+ * 'norec' and 'mvcc'). The exported symbols forward to the engine chosen by
+ * 'tm_create' (see 'dispatch.cpp').
+ */
+#define ENGINE_INTERFACE(name) \
+    namespace name { \
+        shared_t tm_create(size_t, size_t) noexcept; \
+        void     tm_destroy(shared_t) noexcept; \
+        void*    tm_start(shared_t) noexcept; \
+        size_t   tm_size(shared_t) noexcept; \
+        size_t   tm_align(shared_t) noexcept; \
+        tx_t     tm_begin(shared_t, bool) noexcept; \
+        bool     tm_end(shared_t, tx_t) noexcept; \
+        bool     tm_read(shared_t, tx_t, void const*, size_t, void*) noexcept; \
+        bool     tm_write(shared_t, tx_t, void const*, size_t, void*) noexcept; \
+        Alloc    tm_alloc(shared_t, tx_t, size_t, void**) noexcept; \
+        bool     tm_free(shared_t, tx_t, void*) noexcept; \
+    }
+
+ENGINE_INTERFACE(dualvers)
+ENGINE_INTERFACE(rwlock)
+ENGINE_INTERFACE(tl2)
+ENGINE_INTERFACE(norec)
+ENGINE_INTERFACE(mvcc)
+
+#undef ENGINE_INTERFACE
+
+#endif /* ENGINES_H */
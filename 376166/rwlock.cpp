@@ -0,0 +1,243 @@
+/**
+ * @file   rwlock.cpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Global reader-writer lock engine: read-only transactions share the lock,
+ * read-write ones take it exclusively and access the shared memory in place.
+ * No transaction ever aborts. A baseline for the other engines.
+**/
+
+// Requested features
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define _POSIX_C_SOURCE   200809L
+
+// External headers
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Internal headers
+#include "engines.hpp"
+#include "macros.h"
+
+extern "C" {
+#include "shared-lock.h"
+}
+
+namespace rwlock {
+
+/**
+ * @brief Allocated segment, in a list for 'tm_destroy'.
+ */
+struct segment_node {
+    struct segment_node* prev;
+    struct segment_node* next;
+    // uint8_t segment[] // segment of dynamic size
+};
+
+/**
+ * @brief Simple Shared Memory Region (a.k.a Transactional Memory).
+ */
+struct region {
+    struct shared_lock_t lock;   // Global reader-writer lock
+    void* start;                 // Start of the shared memory region (i.e., of the non-deallocable memory segment)
+    size_t size;                 // Size of the non-deallocable memory segment (in bytes)
+    size_t align;                // Size of a word in the shared memory region (in bytes)
+    struct segment_node* allocs; // Segments dynamically allocated via tm_alloc (under the exclusive lock)
+};
+
+// Transaction identifiers, no descriptor being needed
+static const tx_t read_only_tx  = 0;
+static const tx_t read_write_tx = 1;
+
+// -------------------------------------------------------------------------- //
+
+/** Get the distance between a segment node and its segment, which keeps the segment aligned.
+ * @param region Shared memory region
+ * @return Distance (in bytes)
+**/
+static inline size_t segment_pad(struct region* region) {
+    return region->align < sizeof(struct segment_node) ? sizeof(struct segment_node) : region->align;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
+ * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
+ * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
+ * @return Opaque shared memory region handle, 'invalid_shared' on failure
+**/
+shared_t tm_create(size_t size, size_t align) noexcept {
+    struct region* region = new (std::nothrow) struct region;
+    if (unlikely(!region)) {
+        return invalid_shared;
+    }
+    if (posix_memalign(&(region->start), align < sizeof(void*) ? sizeof(void*) : align, size) != 0) {
+        delete region;
+        return invalid_shared;
+    }
+    if (!shared_lock_init(&(region->lock))) {
+        free(region->start);
+        delete region;
+        return invalid_shared;
+    }
+    memset(region->start, 0, size);
+    region->size   = size;
+    region->align  = align;
+    region->allocs = NULL;
+    return region;
+}
+
+/** Destroy (i.e. clean-up + free) a given shared memory region.
+ * @param shared Shared memory region to destroy, with no running transaction
+**/
+void tm_destroy(shared_t shared) noexcept {
+    struct region* region = (struct region*) shared;
+    struct segment_node* list = region->allocs;
+    while (list) {
+        struct segment_node* tail = list->next;
+        free(list);
+        list = tail;
+    }
+    shared_lock_cleanup(&(region->lock));
+    free(region->start);
+    delete region;
+}
+
+/** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
+ * @param shared Shared memory region to query
+ * @return Start address of the first allocated segment
+**/
+void* tm_start(shared_t shared) noexcept {
+    return ((struct region*) shared)->start;
+}
+
+/** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
+ * @param shared Shared memory region to query
+ * @return First allocated segment size
+**/
+size_t tm_size(shared_t shared) noexcept {
+    return ((struct region*) shared)->size;
+}
+
+/** [thread-safe] Return the alignment (in bytes) of the memory accesses on the given shared memory region.
+ * @param shared Shared memory region to query
+ * @return Alignment used globally
+**/
+size_t tm_align(shared_t shared) noexcept {
+    return ((struct region*) shared)->align;
+}
+
+/** [thread-safe] Begin a new transaction on the given shared memory region.
+ * @param shared Shared memory region to start a transaction on
+ * @param is_ro  Whether the transaction is read-only
+ * @return Opaque transaction ID, 'invalid_tx' on failure
+**/
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    struct region* region = (struct region*) shared;
+    if (is_ro) {
+        if (unlikely(!shared_lock_acquire_shared(&(region->lock))))
+            return invalid_tx;
+        return read_only_tx;
+    }
+    if (unlikely(!shared_lock_acquire(&(region->lock))))
+        return invalid_tx;
+    return read_write_tx;
+}
+
+/** [thread-safe] End the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to end
+ * @return Whether the whole transaction committed
+**/
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    struct region* region = (struct region*) shared;
+    if (tx == read_only_tx) {
+        shared_lock_release_shared(&(region->lock));
+    } else {
+        shared_lock_release(&(region->lock));
+    }
+    return true;
+}
+
+/** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in the shared region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in a private region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_read(shared_t unused(shared), tx_t unused(tx), void const* source, size_t size, void* target) noexcept {
+    memcpy(target, source, size);
+    return true;
+}
+
+/** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in a private region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in the shared region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_write(shared_t unused(shared), tx_t unused(tx), void const* source, size_t size, void* target) noexcept {
+    memcpy(target, source, size);
+    return true;
+}
+
+/** [thread-safe] Memory allocation in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param size   Allocation requested size (in bytes), must be a positive multiple of the alignment
+ * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
+ * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
+**/
+Alloc tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) noexcept {
+    struct region* region = (struct region*) shared;
+    // The alignment of the node pointers must be satisfied as well
+    size_t pad = segment_pad(region);
+    struct segment_node* sn;
+    if (unlikely(posix_memalign((void**) &sn, pad, pad + size) != 0))
+        return Alloc::nomem;
+    void* segment = (void*) ((uintptr_t) sn + pad);
+    memset(segment, 0, size);
+    sn->prev = NULL;
+    sn->next = region->allocs;
+    if (sn->next)
+        sn->next->prev = sn;
+    region->allocs = sn;
+    *target = segment;
+    return Alloc::success;
+}
+
+/** [thread-safe] Memory freeing in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param target Address of the first byte of the previously allocated segment to deallocate
+ * @return Whether the whole transaction can continue
+**/
+bool tm_free(shared_t shared, tx_t unused(tx), void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    // No other transaction runs, and this one never aborts: free right away
+    struct segment_node* sn = (struct segment_node*) ((uintptr_t) target - segment_pad(region));
+    if (sn->prev) {
+        sn->prev->next = sn->next;
+    } else {
+        region->allocs = sn->next;
+    }
+    if (sn->next)
+        sn->next->prev = sn->prev;
+    free(sn);
+    return true;
+}
+
+} // namespace rwlock
@@ -0,0 +1,125 @@
+#include "scan.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "the words are loaded as plain 64-bit integers");
+
+/** Check the words one at a time (see 'scan_bits').
+**/
+static uint64_t scan_scalar(std::atomic<uint64_t> const* words, size_t count, uint64_t mask) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (words[i].load(std::memory_order_relaxed) & mask)
+            bits |= (uint64_t) 1 << i;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return bits;
+}
+
+/** Copy the words one at a time (see 'select_words').
+**/
+static void select_scalar(std::atomic<uint64_t> const* controls, void const* clear, void const* set, size_t count, uint64_t mask, void* target) {
+    for (size_t i = 0; i < count; ++i) {
+        void const* source = controls[i].load(std::memory_order_acquire) & mask ? set : clear;
+        memcpy((char*) target + i * sizeof(uint64_t), (char const*) source + i * sizeof(uint64_t), sizeof(uint64_t));
+    }
+}
+
+#if defined(__x86_64__)
+
+// Aligned 8-byte lanes of a vector load are each read atomically on x86-64
+
+/** Check the words 2 at a time, with SSE2 (always available on x86-64; see 'scan_bits').
+**/
+static uint64_t scan_sse2(std::atomic<uint64_t> const* words, size_t count, uint64_t mask) {
+    __m128i m = _mm_set1_epi64x(mask);
+    __m128i zero = _mm_setzero_si128();
+    uint64_t bits = 0;
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((__m128i const*) (words + i)), m);
+        // No 64-bit compare in SSE2: a lane is zero if both its 32-bit halves are
+        __m128i z = _mm_cmpeq_epi32(v, zero);
+        z = _mm_and_si128(z, _mm_shuffle_epi32(z, _MM_SHUFFLE(2, 3, 0, 1)));
+        bits |= (uint64_t) (~_mm_movemask_pd(_mm_castsi128_pd(z)) & 0x3) << i;
+    }
+    return bits | scan_scalar(words + i, count - i, mask) << i;
+}
+
+/** Copy the words 2 at a time, with SSE2 (always available on x86-64; see 'select_words').
+**/
+static void select_sse2(std::atomic<uint64_t> const* controls, void const* clear, void const* set, size_t count, uint64_t mask, void* target) {
+    __m128i m = _mm_set1_epi64x(mask);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((__m128i const*) (controls + i)), m);
+        __m128i z = _mm_cmpeq_epi32(v, zero);
+        z = _mm_and_si128(z, _mm_shuffle_epi32(z, _MM_SHUFFLE(2, 3, 0, 1)));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The copy not selected may be written concurrently, its value is dropped
+        __m128i c = _mm_loadu_si128((__m128i const*) ((uint64_t const*) clear + i));
+        __m128i s = _mm_loadu_si128((__m128i const*) ((uint64_t const*) set + i));
+        _mm_storeu_si128((__m128i*) ((uint64_t*) target + i), _mm_or_si128(_mm_and_si128(z, c), _mm_andnot_si128(z, s)));
+    }
+    select_scalar(controls + i, (uint64_t const*) clear + i, (uint64_t const*) set + i, count - i, mask, (uint64_t*) target + i);
+}
+
+/** Check the words 4 at a time, with AVX2 (see 'scan_bits').
+**/
+__attribute__((target("avx2"))) static uint64_t scan_avx2(std::atomic<uint64_t> const* words, size_t count, uint64_t mask) {
+    __m256i m = _mm256_set1_epi64x(mask);
+    __m256i zero = _mm256_setzero_si256();
+    uint64_t bits = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((__m256i const*) (words + i)), m);
+        __m256i z = _mm256_cmpeq_epi64(v, zero);
+        bits |= (uint64_t) (~_mm256_movemask_pd(_mm256_castsi256_pd(z)) & 0xF) << i;
+    }
+    // Avoid the penalty of mixing in legacy SSE code with dirty upper halves
+    _mm256_zeroupper();
+    return bits | scan_scalar(words + i, count - i, mask) << i;
+}
+
+/** Copy the words 4 at a time, with AVX2 (see 'select_words').
+**/
+__attribute__((target("avx2"))) static void select_avx2(std::atomic<uint64_t> const* controls, void const* clear, void const* set, size_t count, uint64_t mask, void* target) {
+    __m256i m = _mm256_set1_epi64x(mask);
+    __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((__m256i const*) (controls + i)), m);
+        __m256i z = _mm256_cmpeq_epi64(v, zero);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The copy not selected may be written concurrently, its value is dropped
+        __m256i c = _mm256_loadu_si256((__m256i const*) ((uint64_t const*) clear + i));
+        __m256i s = _mm256_loadu_si256((__m256i const*) ((uint64_t const*) set + i));
+        _mm256_storeu_si256((__m256i*) ((uint64_t*) target + i), _mm256_blendv_epi8(s, c, z));
+    }
+    _mm256_zeroupper();
+    select_scalar(controls + i, (uint64_t const*) clear + i, (uint64_t const*) set + i, count - i, mask, (uint64_t*) target + i);
+}
+
+/** Tell whether the processor supports AVX2.
+ * @return Whether AVX2 is supported
+**/
+static bool has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+// Implementations chosen when the library is loaded
+#if defined(__x86_64__)
+scan_fn const scan_bits = has_avx2() ? scan_avx2 : scan_sse2;
+select_fn const select_words = has_avx2() ? select_avx2 : select_sse2;
+#else
+scan_fn const scan_bits = scan_scalar;
+select_fn const select_words = select_scalar;
+#endif
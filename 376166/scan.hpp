@@ -0,0 +1,33 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** Tell which words, among up to 64 consecutive ones, have a bit of the given mask set.
+ * The words are read in SIMD batches (AVX2 or SSE2, chosen when the library
+ * is loaded, or one at a time on other processors), each with at least
+ * relaxed semantics, and the call ends with an acquire fence.
+ * @param words Array of words to check
+ * @param count Number of words, at most 64
+ * @param mask  Mask applied to each word
+ * @return Bit 'i' set if and only if 'words[i] & mask' is non-zero
+**/
+using scan_fn = uint64_t (*)(std::atomic<uint64_t> const* words, size_t count, uint64_t mask);
+extern scan_fn const scan_bits;
+
+/** Copy 8-byte words, each from one of two arrays depending on whether its control word has a bit of the given mask set.
+ * The control words are read as in 'scan_bits', and the words of both arrays
+ * are loaded in SIMD batches, then blended.
+ * @param controls Array of control words
+ * @param clear    Words to copy when the masked control word is zero
+ * @param set      Words to copy when the masked control word is non-zero
+ * @param count    Number of words
+ * @param mask     Mask applied to each control word
+ * @param target   Target array
+**/
+using select_fn = void (*)(std::atomic<uint64_t> const* controls, void const* clear, void const* set, size_t count, uint64_t mask, void* target);
+extern select_fn const select_words;
+
+#endif /* SCAN_H */
@@ -18,223 +18,223 @@
  *
  * @section DESCRIPTION
  *
- * Trivial program that call a function in several threads.
+ * Concurrent bank transfers through the transactional memory interface,
+ * checking that no money is ever created or destroyed. Then two threads race
+ * to take and free the same segment, checking that exactly one of them does.
 **/
 
 // External headers
 #include <atomic>
-#include <iostream>
-#include <thread>
-#include <mutex>
-#include <fstream>
+#include <barrier>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
-#include <ctime>
-#include <tuple>
+#include <iostream>
+#include <random>
+#include <thread>
 #include <vector>
 
 // Internal headers
-#include "tm.cpp"
+#include "tm.hpp"
+
+using Balance = intptr_t;
 
-int TX_num = 10;
-std::vector<int> accounts;
-std::vector<std::tuple<int, int, int>> transactions;
-shared_t tm;
+static size_t const nbaccounts   = 64;
+static size_t const nbtxperwrk   = 20000;
+static Balance const init_balance = 100;
+static size_t const nbrounds     = 200; // Rounds of the race to free a segment
 
-// Forward declaration
-void shared_access(); 
-static void shared_check();
+static shared_t tm;
+static ::std::atomic<bool> failed{false};
 
 // -------------------------------------------------------------------------- //
-/* Initialize the array of accounts,
-at the "start address" of the shared memory */
-void transfer(int src, int dst, int amount) {
-    std::atomic_int *src_account = new std::atomic_int();
-    std::atomic_int *dst_account = new std::atomic_int();
+
+/** Run the given transaction body until it commits.
+ * @param is_ro Whether the transaction is read-only
+ * @param body  Transaction body, returning whether the transaction can continue
+**/
+template<class Func> static void transactional(bool is_ro, Func&& body) {
     while (true) {
-        try {
-            tx_t tx = tm_begin(tm, true);
-            tm_read(tm, tx, &accounts[src], sizeof(int), src_account);
-            if (*src_account < amount) {
-                tm_end(tm, tx);
-                break;
-            }
-            tm_read(tm, tx, &accounts[src], sizeof(int), src_account);
-            tm_read(tm, tx, &accounts[dst], sizeof(int), dst_account);
-            tm_write(tm, tx, &accounts[dst], sizeof(int), dst_account + amount);
-            tm_write(tm, tx, &accounts[src], sizeof(int), src_account - amount);
-            std::cout << "Transfer " << amount << " " << src << "->" << dst << std::endl;
-            tm_end(tm, tx);
-            break;
-        } catch (std::exception e) {
-            perror(e.what());
-            continue;
+        tx_t tx = tm_begin(tm, is_ro);
+        if (tx == invalid_tx) {
+            ::std::cerr << "ERROR: unable to begin a transaction" << ::std::endl;
+            ::std::exit(1);
         }
+        if (!body(tx))
+            continue; // Aborted
+        if (tm_end(tm, tx))
+            return;
     }
-    free(src_account);
-    free(dst_account);
 }
 
-// -------------------------------------------------------------------------- //
-// Thread accessing the shared memory (a mere shared counter in this program)
-
-/** Thread entry point.
- * @param nb   Total number of threads
- * @param id   This thread ID (from 0 to nb-1 included)
- * @param lock Lock to use to protect the shared memory (read & written by 'shared_access')
+/** Transfer one unit between two accounts.
+ * @param src Index of the sender account
+ * @param dst Index of the receiver account
 **/
-void entry_point(size_t nb, size_t id) {
-    ::printf("Hello from thread %lu/%lu\n", id, nb);
-    for (size_t i = 0; i < transactions.size(); i++)
-    {
-        auto [src_id, dst_id, tx_amount] = transactions[i];
-        if (src_id == id) transfer(src_id, dst_id, tx_amount);
-    }
+static void transfer(size_t src, size_t dst) {
+    Balance* accounts = (Balance*) tm_start(tm);
+    transactional(false, [&](tx_t tx) {
+        Balance src_val, dst_val;
+        if (!tm_read(tm, tx, &accounts[src], sizeof(Balance), &src_val))
+            return false;
+        if (src_val <= 0)
+            return true;
+        if (!tm_read(tm, tx, &accounts[dst], sizeof(Balance), &dst_val))
+            return false;
+        if (src == dst)
+            return true;
+        --src_val;
+        ++dst_val;
+        return tm_write(tm, tx, &src_val, sizeof(Balance), &accounts[src])
+            && tm_write(tm, tx, &dst_val, sizeof(Balance), &accounts[dst]);
+    });
 }
 
-// -------------------------------------------------------------------------- //
-// Shared memory, access function and consistency check
-
-static int counter = 0;
-static ::std::atomic<int> check_counter{0};
-
-/** Performs some operations on some shared memory.
+/** Sum every account in a read-only transaction.
+ * @return Total balance
 **/
-void shared_access() {
-    ++counter;
-    check_counter.fetch_add(1, ::std::memory_order_relaxed);
+static Balance sum() {
+    Balance* accounts = (Balance*) tm_start(tm);
+    Balance total = 0;
+    transactional(true, [&](tx_t tx) {
+        Balance all[nbaccounts];
+        if (!tm_read(tm, tx, accounts, sizeof(all), all))
+            return false;
+        total = 0;
+        for (auto val: all)
+            total += val;
+        return true;
+    });
+    return total;
 }
 
-/** (Empirically) checks that concurrent operations did not break consistency, warn accordingly.
+/** Allocate a scratch segment, write it and free it in a second transaction.
 **/
-static void shared_check() {
-    auto calls = check_counter.load(::std::memory_order_relaxed);
-    if (counter == calls) {
-        ::std::cout << "** No inconsistency detected (" << counter << " == " << calls << ") **" << ::std::endl;
-    } else {
-        ::std::cout << "** Inconsistency detected (" << counter << " != " << calls << ") **" << ::std::endl;
-    }
+static void churn() {
+    void* segment = nullptr;
+    transactional(false, [&](tx_t tx) {
+        if (tm_alloc(tm, tx, 4 * sizeof(Balance), &segment) != Alloc::success)
+            return false;
+        Balance val = init_balance;
+        return tm_write(tm, tx, &val, sizeof(Balance), segment);
+    });
+    transactional(false, [&](tx_t tx) {
+        return tm_free(tm, tx, segment);
+    });
 }
 
-void transaction_generation(int n, int tx_num, std::string outputFilePath) {
-    srand(time(NULL)); // Initialize random seed
-
-    std::ofstream file(outputFilePath);
-    if (!file) {
-        std::cerr << "Unable to open file: " << outputFilePath << std::endl;
-        return;
-    }
-
-    // Write n and tx_num
-    file << n << " " << tx_num << "\n";
-
-    // Generate random balance for n peers
-    for (int i = 0; i < n; ++i) {
-        file << rand() % 1000 << " "; // Generate random balance between 0 and 999
-    }
-    file << "\n";
-
-    // Generate tx_num transactions
-    for (int i = 0; i < tx_num; ++i) {
-        int src_id = rand() % n; // Generate random source id
-        int dst_id;
-        do {
-            dst_id = rand() % n; // Generate random destination id
-        } while (dst_id == src_id); // Guarantee dst_id != src_id
-
-        int tx_amount = rand() % 1000; // Generate random transaction amount between 0 and 999
-
-        file << src_id << " " << dst_id << " " << tx_amount << "\n";
+/** Race two threads to free the same segment, each taking its address out of the shared word before freeing it.
+ * @param slot Shared word holding the address of the segment, null once taken
+ * @return Whether exactly one of the two committed a free in every round
+**/
+static bool free_race(void** slot) {
+    ::std::barrier sync{3};
+    ::std::atomic<int> frees{0};
+    auto racer = [&]() {
+        for (size_t round = 0; round < nbrounds; ++round) {
+            sync.arrive_and_wait();
+            bool freed = false;
+            transactional(false, [&](tx_t tx) {
+                void* segment;
+                freed = false;
+                if (!tm_read(tm, tx, slot, sizeof(segment), &segment))
+                    return false;
+                if (!segment)
+                    return true; // Taken by the other one
+                void* null = nullptr;
+                if (!tm_write(tm, tx, &null, sizeof(null), slot) || !tm_free(tm, tx, segment))
+                    return false;
+                freed = true;
+                return true;
+            });
+            if (freed)
+                frees.fetch_add(1);
+            sync.arrive_and_wait();
+        }
+    };
+    ::std::thread first{racer}, second{racer};
+    bool ok = true;
+    for (size_t round = 0; round < nbrounds; ++round) {
+        transactional(false, [&](tx_t tx) {
+            void* segment;
+            if (tm_alloc(tm, tx, 4 * sizeof(Balance), &segment) != Alloc::success)
+                return false;
+            return tm_write(tm, tx, &segment, sizeof(segment), slot);
+        });
+        frees = 0;
+        sync.arrive_and_wait();
+        sync.arrive_and_wait();
+        if (frees != 1)
+            ok = false;
     }
-
-    file.close();
+    first.join();
+    second.join();
+    return ok;
 }
 
-void transaction_init(std::string inputFilePath) {
-    std::ifstream file(inputFilePath);
-    if (!file) {
-        std::cerr << "Unable to open file: " << inputFilePath << std::endl;
-        return;
-    }
-
-    int n, tx_num;
-    file >> n >> tx_num;
-
-    accounts.resize(n);
-    for (int i = 0; i < n; ++i) {
-        file >> accounts[i];
-    }
+// -------------------------------------------------------------------------- //
 
-    transactions.resize(tx_num);
-    for (int i = 0; i < tx_num; ++i) {
-        int src_id, dst_id, tx_amount;
-        file >> src_id >> dst_id >> tx_amount;
-        transactions[i] = std::make_tuple(src_id, dst_id, tx_amount);
+/** Thread entry point.
+ * @param id This thread ID
+**/
+static void entry_point(size_t id) {
+    ::std::minstd_rand engine{static_cast<unsigned int>(id + 1)};
+    ::std::uniform_int_distribution<size_t> account{0, nbaccounts - 1};
+    ::std::uniform_int_distribution<int> dice{0, 99};
+    for (size_t i = 0; i < nbtxperwrk; ++i) {
+        auto roll = dice(engine);
+        if (roll < 20) {
+            if (sum() != init_balance * static_cast<Balance>(nbaccounts))
+                failed = true;
+        } else if (roll < 21) {
+            churn();
+        } else {
+            transfer(account(engine), account(engine));
+        }
     }
-
-    file.close();
 }
 
-// -------------------------------------------------------------------------- //
-// Thread launches and management
-
 /** Program entry point.
  * @param argc Arguments count
  * @param argv Arguments values
  * @return Program return code
 **/
-int main(int, char**) {
-    // Init threads
-    auto const nbworkers = []() {
-        auto res = ::std::thread::hardware_concurrency();
-        if (res == 0) {
-            ::std::cout << "WARNING: unable to query '::std::thread::hardware_concurrency()', falling back to 4 threads" << ::std::endl;
-            res = 4;
-        }
-        return static_cast<size_t>(res);
-    }();
-
-    // Init transactions
-    ::std::thread threads[nbworkers];
-    transaction_generation(nbworkers, TX_num, "test.txt");
-    transaction_init("test.txt");
-    for (size_t i = 0; i < accounts.size(); i++)
-    {
-        std::cout << accounts[i] << " ";
-    }
-    putchar(10);
+int main(int argc, char** argv) {
+    size_t const nbworkers = argc > 1 ? ::std::strtoul(argv[1], nullptr, 10) : 8;
 
     // Init shared memory
-    tm = tm_create(transactions.size() * sizeof(struct word), sizeof(struct word));
+    // The accounts, then the address of the segment to free in 'free_race'
+    tm = tm_create((nbaccounts + 1) * sizeof(Balance), sizeof(Balance));
     if (tm == invalid_shared) {
         ::std::cerr << "ERROR: unable to create shared memory" << ::std::endl;
         return 1;
     }
-    std::cout << "Shared memory size: " << tm_size(tm) << std::endl;
-    std::cout << "Shared memory align: " << tm_align(tm) << std::endl;
-    std::cout << "Shared memory start: " << tm_start(tm) << std::endl;
-    
-    // Launch threads
-    for (size_t i = 0; i < nbworkers; ++i) {
-        threads[i] = ::std::thread{[&](size_t i) {
-            entry_point(nbworkers, i);
-        }, i};
-    }
-    
-    // Wait for threads to finish
-    for (auto&& thread: threads) thread.join();
-    shared_check();
-
-    for (size_t i = 0; i < accounts.size(); i++)
-    {
-        std::cout << accounts[i] << " ";
+    transactional(false, [&](tx_t tx) {
+        Balance* accounts = (Balance*) tm_start(tm);
+        for (size_t i = 0; i < nbaccounts; ++i) {
+            if (!tm_write(tm, tx, &init_balance, sizeof(Balance), &accounts[i]))
+                return false;
+        }
+        return true;
+    });
+
+    // Launch threads, and wait for them to finish
+    ::std::vector<::std::thread> threads;
+    for (size_t i = 0; i < nbworkers; ++i)
+        threads.emplace_back(entry_point, i);
+    for (auto&& thread: threads)
+        thread.join();
+    if (!free_race((void**) tm_start(tm) + nbaccounts)) {
+        ::std::cout << "** Inconsistency detected (a segment freed twice or never) **" << ::std::endl;
+        return 1;
     }
-    putchar(10);
-
-    // Destroy shared memory
-    try {
-        tm_destroy(tm);
-    } catch(const std::exception& e) {}
 
+    auto total = sum();
+    tm_destroy(tm);
+    if (failed || total != init_balance * static_cast<Balance>(nbaccounts)) {
+        ::std::cout << "** Inconsistency detected (" << total << " != " << init_balance * static_cast<Balance>(nbaccounts) << ") **" << ::std::endl;
+        return 1;
+    }
+    ::std::cout << "** No inconsistency detected (" << nbworkers << " threads) **" << ::std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -26,105 +26,1468 @@
 #endif
 
 // External headers
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // Internal headers
 #include "tm.hpp"
 
+#include "contention.hpp"
+#include "dual-vers.hpp"
 #include "macros.h"
+#include "scan.hpp"
 
-static const tx_t read_only_tx  = UINTPTR_MAX - 10;
-static const tx_t read_write_tx = UINTPTR_MAX - 11;
+// Behind the dispatch table of the library (see 'dispatch.cpp')
+namespace dualvers {
 
+/**
+ * @brief Encoding of a word's control state, packed in one 64-bit atomic.
+ *
+ * 'valid_bit' tells the readable copy. The rest is the access set of the
+ * current epoch: nobody ('no_access'), a single transaction (the address of
+ * the epoch log of its thread, with 'written_bit' set if it wrote the word) or
+ * several read-write transactions ('multi_access'), none of which wrote it.
+ * Logs being 8-byte aligned leaves the 3 low bits to the flags, so a
+ * single load reads the whole state and a single CAS updates it: a write can
+ * never slip in between a read's check and its registration.
+ */
+static const uint64_t no_access    = 0;
+static const uint64_t written_bit  = 1;
+static const uint64_t multi_access = 2;
+static const uint64_t valid_bit    = 4; // Clear: copy A is readable, set: copy B is readable
+static const uint64_t access_mask  = ~valid_bit;
+
+/**
+ * @brief Addressing scheme.
+ *
+ * An address handed out packs the id of its segment in the 16 most significant
+ * bits, and the byte offset within the segment in the 48 others (segment sizes
+ * stay below 2^48). Resolving the segment and the control block of a word is
+ * then a shift and an index. Segment id 0 is never used, so that no address
+ * is null.
+ */
+static const int addr_shift = 48;
+static const uintptr_t addr_offset_mask = ((uintptr_t) 1 << addr_shift) - 1;
+static const size_t max_segments = (size_t) 1 << (64 - addr_shift);
+
+/**
+ * @brief Control block of one word.
+ */
+struct word {
+    std::atomic<uint64_t> control; // Readable copy, access set and written flag (see above)
+};
+static_assert(sizeof(struct word) == sizeof(std::atomic<uint64_t>), "the control blocks of a run are scanned as an array of control words");
+
+/**
+ * @brief Lazily materialized block of copy B (SoA layout only).
+ *
+ * Copy B is only needed for the words written at least once, so it is split
+ * in blocks of 'lazy_block_shift' bytes (or of one word, if larger), each
+ * allocated by the first write of one of its words. Until then, every word
+ * of the block has copy A readable ('valid_bit' clear) and nothing reads the
+ * block. Every 'lazy_period' epochs, the blocks not written since the previous
+ * sweep are cold: the words readable in them are copied back to copy A and
+ * they are freed, so read-mostly data only keeps one copy resident.
+ */
+static const size_t lazy_block_shift = 12; // Binary logarithm of the minimal size of a block (in bytes)
+static const uint64_t lazy_period    = 128; // Number of epochs between two sweeps of the cold blocks
+
+struct block {
+    std::atomic<char*> copy; // Block of copy B, 'NULL' if not materialized
+    std::atomic<bool> hot;   // Whether a word of the block was written since the last sweep
+};
+
+/**
+ * @brief Allocated segment: both copies of each word and their control blocks.
+ *
+ * A segment lives in a slab object (see 'slab_*'), sized for the largest
+ * segment of its size class, and laid out as this header followed by:
+ * - by default (SoA), the block table of copy B, copy A and the control
+ *   blocks, in 3 arrays, the blocks of copy B being allocated on demand (the
+ *   table right after the header, to be found without a load);
+ * - with 'LAYOUT_AOS' defined, one cell per word holding its control block,
+ *   copy A and copy B, so accessing a small word touches a single line (copy
+ *   B then stays inline, as a lazy one would split the cell).
+ */
+struct segment {
+#ifdef LAYOUT_AOS
+    char* cells;         // Control block, copy A and copy B of each word
+#else
+    char* copy;          // Copy A
+    struct word* words;  // Control block of each word
+#endif
+    size_t size;         // Size of the segment (in bytes)
+    uint16_t id;         // Segment id, in the high bits of its addresses (0: not registered)
+    uint8_t cls;         // Size class, binary logarithm of the capacity (in bytes) of the copies
+    bool used;           // Whether the segment was handed out before (otherwise still zero from its mapping)
+    std::atomic<bool> freed; // Whether a running transaction of the epoch freed the segment
+};
+
+/**
+ * @brief Slab allocator of the segments.
+ *
+ * Segments are carved by size class from chunks owned by the region, and
+ * cached in per-thread magazines, so allocating transactions only take the
+ * region's lock to refill an empty magazine. A magazine is held by the epoch
+ * log of its thread in the region, so it is kept when the thread switches to
+ * another region and back. Committed frees are recycled to the region's depot
+ * at the end of the epoch that freed them, once no transaction can still
+ * access them; the segments allocated by an aborted transaction are never
+ * seen by another one, and go straight back to the magazine of their thread
+ * (still registered under their id).
+ *
+ * Chunks are anonymous mappings: the kernel backs them with zero pages, and
+ * an all-zero segment (header included) is a fresh one, with no word accessed
+ * and copy A readable everywhere. Handing out a segment for the first time is
+ * then O(1) whatever its size, its pages being only touched (and accounted
+ * for, the mappings reserving no swap) when used, and only recycled segments
+ * are zeroed again (their whole pages being handed back to the kernel if
+ * large). The region unmaps its chunks at once.
+ *
+ * Large regions accessed at random miss the TLB a lot with base pages, so the
+ * chunks can be backed by huge pages (see 'huge_mode_of').
+ */
+static const size_t slab_classes = 64;
+static const size_t slab_chunk   = (size_t) 1 << 16; // Minimal size of a chunk (in bytes)
+static const size_t slab_batch   = 16;               // Number of segments moved at once from the depot to a magazine
+static const size_t slab_align   = 64;               // Minimal alignment of a slab object (in bytes)
+static const size_t slab_madvise = (size_t) 1 << 18; // Minimal size of a range to zero by handing its pages back (in bytes)
+
+/**
+ * @brief Huge page backing of the chunks, selected for each region in 'tm_create' by 'TM_HUGE_PAGES'.
+ *
+ * - 'huge_none' (unset, empty or "0"): base pages only;
+ * - 'huge_thp' ("thp"): transparent huge pages, asked with 'MADV_HUGEPAGE';
+ * - 'huge_tlb' (anything else): hugetlbfs pages ('MAP_HUGETLB'), falling back
+ *   to transparent huge pages once the pool is exhausted.
+ * With huge pages, chunks are at least one huge page large and aligned on one,
+ * so small segments share huge pages too. Transparent huge pages falling back
+ * to base pages is up to the kernel.
+ */
+static const int huge_none = 0;
+static const int huge_thp  = 1;
+static const int huge_tlb  = 2;
+static const size_t huge_page = (size_t) 1 << 21; // Size of a huge page (in bytes)
+
+/**
+ * @brief Anonymous mapping a chunk of slab objects is carved from.
+ */
+struct chunk {
+    void* base;  // Start of the mapping
+    size_t size; // Size of the mapping (in bytes)
+};
+
+struct region;
+struct transaction;
+
+/**
+ * @brief Kernels reading or writing a run of words of one segment, specialized at compile time for one alignment.
+ *
+ * The region picks its table once in 'tm_create', and a transaction its read
+ * kernel in 'tm_begin', so the access paths branch neither on the alignment
+ * nor on the transaction mode, and copy each word with a fixed-size 'memcpy'.
+ */
+struct kernels {
+    bool (*read_ro)(struct region*, struct transaction*, struct segment*, size_t index, size_t count, void* target);       // Read in a read-only transaction
+    bool (*read_rw)(struct region*, struct transaction*, struct segment*, size_t index, size_t count, void* target);       // Read in a read-write transaction
+    bool (*write)(struct region*, struct transaction*, struct segment*, size_t index, size_t count, void const* source);   // Write (in a read-write transaction)
+    bool (*write_inplace)(struct region*, struct transaction*, struct segment*, size_t index, size_t count, void const* source); // Write in an irrevocable transaction
+};
+
+/**
+ * @brief Irrevocable mode.
+ *
+ * A thread whose read-write transactions aborted 'TM_IRREVOCABLE_AFTER' times
+ * in a row ('irrevocable_after' by default, 0 to never) runs its next one
+ * alone in an epoch (see 'enter_serial'), where nothing can conflict with it:
+ * it reads the readable copies and writes them in place, registering and
+ * logging nothing, and always commits (see 'tm_free'). While it waits for the
+ * running epoch to end, no transaction enters; with 'TM_IRREVOCABLE_DRAIN' set
+ * to "kill" rather than "wait" (the default), the running read-write attempts
+ * are also killed (see 'cm_kill'), to abort at their next access instead of
+ * running to their end. Irrevocable transactions run one at a time.
+ */
+static const uint64_t irrevocable_after = 16;
+
+/**
+ * @brief Counters of the transactions of one thread, printed by 'tm_destroy' if 'TM_STATS' is set (and not "0").
+ */
+struct tx_stats {
+    uint64_t commits;     // Committed read-write transactions (irrevocable ones included)
+    uint64_t aborts;      // Aborted read-write attempts
+    uint64_t irrevocable; // Read-write transactions run in irrevocable mode
+    uint64_t reads;       // Committed read-only transactions
+};
+
+/**
+ * @brief Adaptive mode.
+ *
+ * Under heavy contention, most read-write attempts abort, and running the
+ * read-write transactions one at a time (as the global lock of the reference
+ * does) wastes less work. With 'TM_ADAPT' set (to anything but "0"), the end
+ * of an epoch (a quiescent point) samples, over windows of at least
+ * 'adapt_samples' read-write attempts, the percentage of aborted attempts, the
+ * percentage of read-only transactions and the average number of words
+ * registered by an optimistic attempt. When a window has at least 'TM_ADAPT_ABORTS' percent of
+ * aborted attempts ('adapt_aborts' by default) and less than 'adapt_readers'
+ * percent of read-only transactions (which the serial mode delays), the
+ * region switches to the serial mode: every read-write transaction runs
+ * irrevocably (see 'tx_irrevocable'), while the read-only ones keep sharing
+ * the epochs in between. As nothing aborts there, the serial mode lasts a
+ * fixed number of windows, then the region probes the optimistic mode again;
+ * a probe failing at its first window doubles the length of the next serial
+ * mode (up to 'adapt_hold_max' windows). Each switch is logged to stderr,
+ * with the metrics of the window that triggered it.
+ */
+static const int mode_optimistic = 0;
+static const int mode_serial     = 1;
+
+static const uint64_t adapt_period   = 16;  // Number of epochs between two checks of the window
+static const uint64_t adapt_samples  = 256; // Minimal number of read-write attempts in a window
+static const uint64_t adapt_aborts   = 50;  // Default percentage of aborted attempts from which to switch to the serial mode
+static const uint64_t adapt_readers  = 90;  // Percentage of read-only transactions from which to stay optimistic
+static const uint64_t adapt_hold_max = 64;  // Maximal number of windows of a serial mode
+
+/**
+ * @brief State of the adaptive mode, only updated at the end of the epochs.
+ */
+struct adapt_state {
+    std::atomic<int> mode;  // Mode of the new read-write transactions (see 'mode_*')
+    bool enabled;           // Whether to adapt the mode
+    uint64_t aborts_high;   // Percentage of aborted attempts from which to switch to the serial mode
+    uint64_t epochs;        // Number of epochs ended since the last check
+    uint64_t footprint;     // Number of words registered by the attempts of the window
+    struct tx_stats base;   // Counters summed over the logs at the start of the window
+    uint64_t windows;       // Number of windows since the last switch
+    uint64_t hold;          // Number of windows of the next serial mode
+};
+
+/**
+ * @brief Control blocks accessed by the read-write transactions of one thread in the current epoch.
+ *
+ * A thread runs at most one read-write transaction per epoch (it cannot enter
+ * an epoch before the previous one it ran in ends), so the log holds the
+ * accesses of a single transaction, and the end of the epoch only walks the
+ * logs instead of every word of the region. Logs are owned by the region, as
+ * the last transaction of an epoch may walk them after their thread exited,
+ * which makes them the identity of their thread's transactions in the access
+ * sets too (a conflicting transaction reaches the contention state through it).
+ * Hence a thread runs at most one transaction at a time in a region: a second
+ * 'tm_begin' fails while the first one runs, as it would share its accesses
+ * and could wait for the end of the epoch the first one holds.
+ */
+struct epoch_log {
+    std::vector<struct word*> written;  // Words written by a committed transaction
+    std::vector<struct word*> accessed; // Words registered in an access set, not written
+    struct cm_state cm;                 // Contention state of the read-write transactions of the thread
+    struct tx_stats stats;              // Counters of the transactions of the thread (owner thread, read at the end of the epochs)
+    std::thread::id owner;              // Thread the log belongs to
+    bool live;                          // Whether a transaction of the thread is running in the region (owner thread only)
+    std::vector<struct segment*> magazine[slab_classes]; // Free segments cached for the thread, by size class (owner thread only)
+};
+static_assert(alignof(struct epoch_log) >= 8, "the flags of a control word need the 3 low bits of the log addresses");
+
+/**
+ * @brief Materialized block of copy B, as listed by the region for the sweeps.
+ *
+ * Segment objects are only released with the region, so an entry stays valid
+ * after its segment is freed (the block is then swept as any cold one).
+ */
+struct lazy_block {
+    struct segment* seg; // Segment of the block
+    size_t index;        // Index of the block in its segment
+};
 
 /**
  * @brief Simple Shared Memory Region (a.k.a Transactional Memory).
  */
 struct region {
-    void* start;        // Start of the shared memory region (i.e., of the non-deallocable memory segment)
-    Alloc allocs;       // Shared memory transactions status
-    size_t size;        // Size of the non-deallocable memory segment (in bytes)
-    size_t align;       // Size of a word in the shared memory region (in bytes)
+    struct batcher batcher;      // Batcher of the transactions
+    std::atomic<struct segment*>* segments; // Segment table, indexed by segment id
+    std::atomic<uint32_t> next_id; // Lowest segment id never used
+    std::atomic<uint32_t> free_count; // Number of ids in 'free_ids'
+    uint16_t* free_ids;          // Ids of the deallocated segments (only pushed at the end of an epoch)
+    std::mutex pending_lock;     // Protects 'pending'
+    std::vector<struct segment*> pending; // Segments to deallocate at the end of the epoch
+    std::mutex slab_lock;        // Protects 'chunks' and 'depots'
+    std::vector<struct chunk> chunks; // Chunks the slab objects are carved from
+    std::vector<struct segment*> depots[slab_classes]; // Recycled segments, by size class
+    std::mutex logs_lock;        // Protects 'logs'
+    std::vector<struct epoch_log*> logs; // Epoch logs of the threads that ran a transaction
+#ifndef LAYOUT_AOS
+    std::mutex blocks_lock;      // Protects 'blocks'
+    std::vector<struct lazy_block> blocks; // Materialized blocks of copy B
+    uint64_t epochs;             // Number of ended epochs, for the sweeps of the cold blocks
+    size_t block_shift;          // Binary logarithm of the size of a block of copy B
+#endif
+    uint64_t serial;             // Serial number, telling the per-thread state of this region from stale one
+    size_t size;                 // Size of the non-deallocable memory segment (in bytes)
+    size_t align;                // Size of a word in the shared memory region (in bytes)
+    size_t align_shift;          // Binary logarithm of 'align'
+    size_t page_size;            // Size of a base page (in bytes)
+    int huge;                    // Huge page backing of the chunks (see 'huge_*')
+    bool hugetlb_failed;         // Whether mapping hugetlbfs pages failed (then not tried again), protected by 'slab_lock'
+    struct kernels const* kernels; // Word kernels for 'align'
+    int policy;                  // Contention management policy (see 'cm_*' policies)
+    std::mutex irrevocable_lock; // Held by the irrevocable transaction, from 'tm_begin' to 'tm_end'
+    uint64_t irrevocable_after;  // Number of consecutive aborts of a thread after which it runs irrevocably, 0 for never
+    bool irrevocable_kill;       // Whether an irrevocable transaction kills the running attempts rather than waiting for them
+    bool stats;                  // Whether to print the counters of the transactions in 'tm_destroy'
+    struct adapt_state adapt;    // Adaptive mode of the read-write transactions
+#ifdef LAYOUT_AOS
+    size_t cell_size;            // Size of the cell of a word (in bytes)
+#endif
 };
 
 /**
- * @brief Atomic Word.
+ * @brief Transaction identifiers.
+ *
+ * Descriptors come from a pool per thread ('tx_pool'), grown on demand and
+ * only freed when the thread exits: once warmed up, beginning and ending a
+ * transaction allocates nothing, the logs being cleared (keeping their
+ * capacity) rather than freed. A 'tx_t' packs the address of the descriptor
+ * (in the 48 least significant bits) with its generation (in the 16 others),
+ * which is bumped when the descriptor goes back to the pool: an identifier
+ * used after its transaction ended no longer matches, and the call fails
+ * (until the generation wraps around).
  */
-struct word {
-    std::atomic_bool valid; // 0: copy_A is valid, 1: copy_B is valid (valid means "readable copy")
-    std::atomic_bool accessed, written;
-    std::atomic_uint32_t copy_A, copy_B;
+static const int tx_generation_shift = 48;
+static const uintptr_t tx_pointer_mask = ((uintptr_t) 1 << tx_generation_shift) - 1;
+
+/**
+ * @brief Transaction descriptor, on its own cache lines.
+ */
+struct alignas(64) transaction {
+    bool is_ro;                            // Whether the transaction is read-only
+    bool is_irrevocable;                   // Whether the transaction runs in irrevocable mode
+    decltype(kernels::read_ro) read;       // Read kernel for the mode of the transaction
+    decltype(kernels::write) write;        // Write kernel for the mode of the transaction
+    int policy;                            // Contention management policy of the region
+    struct epoch_log* log;                 // Epoch log of the thread in the region, receiving the accesses of read-write transactions and the counters
+    std::vector<struct segment*> allocs;   // Segments allocated by the transaction, to recycle on abort
+    std::vector<struct segment*> frees;    // Segments freed by the transaction, to free on commit
+    uint16_t generation;                   // Generation of the descriptor, in the identifier of its transaction
+    struct transaction* next;              // Next free descriptor of the pool
+};
+
+/**
+ * @brief Pool of the descriptors of one thread.
+ */
+struct tx_pool {
+    struct transaction* free = NULL;      // Free descriptors, the last released first
+    std::vector<struct transaction*> all; // Every descriptor of the pool, deleted with it
+    ~tx_pool() {
+        for (auto tx: all)
+            delete tx;
+    }
 };
 
 /**
- * @brief List of dynamically allocated segments.
+ * @brief Epoch log of the calling thread in the region it used last.
+ *
+ * Kept per thread rather than in a descriptor, as a descriptor of the pool
+ * may have served last on another region.
  */
-std::list<region*> segment_list;
+struct log_cache {
+    uint64_t serial;       // Serial number of the region, 0 for none
+    struct epoch_log* log; // Epoch log of the calling thread in that region
+};
+
+static thread_local struct tx_pool tx_local;
+static thread_local struct log_cache log_local = {0, NULL};
+
+static std::atomic<uint64_t> region_serial{0}; // Last serial number given to a region
+
+// -------------------------------------------------------------------------- //
+
+/** Get the segment of the given address.
+ * @param region Shared memory region
+ * @param addr   Address in the shared memory region
+ * @return Segment of the address
+**/
+static inline struct segment* segment_of(struct region* region, void const* addr) {
+    return region->segments[(uintptr_t) addr >> addr_shift].load(std::memory_order_acquire);
+}
+
+/** Get the index, within its segment, of the word at the given address.
+ * @param region Shared memory region
+ * @param addr   Address in the shared memory region
+ * @return Index of the word
+**/
+static inline size_t index_of(struct region* region, void const* addr) {
+    return ((uintptr_t) addr & addr_offset_mask) >> region->align_shift;
+}
+
+/** Get the address of the first word of the given segment.
+ * @param seg Segment
+ * @return Address of the segment
+**/
+static inline void* address_of(struct segment* seg) {
+    return (void*) ((uintptr_t) seg->id << addr_shift);
+}
+
+/** Round the given size up to a multiple of the given power of 2.
+ * @param size  Size to round
+ * @param align Power of 2
+ * @return Rounded size
+**/
+static constexpr inline size_t round_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+/** Get the size class of a segment of the given size.
+ * @param region Shared memory region
+ * @param size   Size of the segment (in bytes)
+ * @return Size class
+**/
+static inline size_t slab_class(struct region* region, size_t size) {
+    size_t cls = size > 1 ? 64 - __builtin_clzl(size - 1) : 0;
+    return cls < region->align_shift ? region->align_shift : cls;
+}
+
+/** Get the epoch log of the calling thread for the given region, registering a new one if needed.
+ * @param region Shared memory region
+ * @return Epoch log of the calling thread, 'NULL' on failure
+**/
+static struct epoch_log* epoch_log_of(struct region* region) {
+    struct log_cache* cache = &log_local;
+    if (likely(cache->serial == region->serial))
+        return cache->log;
+    std::thread::id self = std::this_thread::get_id();
+    struct epoch_log* log = NULL;
+    {
+        // Back to a region used before: its log keeps the contention state and counters of the thread
+        std::unique_lock<std::mutex> guard{region->logs_lock};
+        for (auto other: region->logs) {
+            if (other->owner == self) {
+                log = other;
+                break;
+            }
+        }
+    }
+    if (!log) {
+        log = new (std::nothrow) struct epoch_log;
+        if (unlikely(!log))
+            return NULL;
+        cm_init(&(log->cm));
+        log->stats = tx_stats{0, 0, 0, 0};
+        log->owner = self;
+        log->live  = false;
+        try {
+            std::unique_lock<std::mutex> guard{region->logs_lock};
+            region->logs.push_back(log);
+        } catch (const std::bad_alloc&) {
+            delete log;
+            return NULL;
+        }
+    }
+    *cache = log_cache{region->serial, log};
+    return log;
+}
+
+/** Get the magazine of the calling thread for the given region, held by its epoch log there.
+ * @param region Shared memory region
+ * @return Magazine of the calling thread (one free list per size class), 'NULL' on failure
+**/
+static std::vector<struct segment*>* magazine_of(struct region* region) {
+    struct epoch_log* log = epoch_log_of(region);
+    return likely(log) ? log->magazine : NULL;
+}
+
+/** Get the huge page backing asked for by the environment.
+ * @return Huge page backing (see 'huge_*')
+**/
+static int huge_mode_of() {
+    char const* env = getenv("TM_HUGE_PAGES");
+    if (!env || env[0] == '\0' || strcmp(env, "0") == 0)
+        return huge_none;
+    return strcmp(env, "thp") == 0 ? huge_thp : huge_tlb;
+}
+
+/** Get the size of the pages backing the chunks, at which granularity they can be handed back to the kernel.
+ * @param region Shared memory region
+ * @return Size of a page (in bytes)
+**/
+static inline size_t chunk_page(struct region* region) {
+    return region->huge == huge_none ? region->page_size : huge_page;
+}
+
+/** Map a new chunk, with the region's slab lock taken.
+ * @param region Shared memory region
+ * @param size   Size of the chunk (in bytes)
+ * @param align  Alignment of the chunk (in bytes, a power of 2)
+ * @return Start of the chunk, 'NULL' on failure
+**/
+static char* chunk_map(struct region* region, size_t size, size_t align) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    if (region->huge == huge_tlb && !region->hugetlb_failed) {
+        // Mappings are aligned on their page size, larger alignments are obtained by padding;
+        // huge pages are reserved (no 'MAP_NORESERVE') so that an empty pool fails here rather than at first touch
+        size_t length = round_up(size + (align > huge_page ? align - huge_page : 0), huge_page);
+        void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            region->chunks.push_back(chunk{base, length});
+            return (char*) round_up((uintptr_t) base, align);
+        }
+        region->hugetlb_failed = true; // Pool exhausted or not configured
+    }
+    if (region->huge != huge_none && align < huge_page)
+        align = huge_page; // For the kernel to back the whole chunk with huge pages
+    size_t length = round_up(size, region->page_size) + (align > region->page_size ? align - region->page_size : 0);
+    void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (unlikely(base == MAP_FAILED))
+        return NULL;
+    if (region->huge != huge_none)
+        madvise(base, length, MADV_HUGEPAGE); // Only a hint, failure is harmless
+    region->chunks.push_back(chunk{base, length});
+    return (char*) round_up((uintptr_t) base, align);
+}
+
+/** Carve a new chunk into free segments of the given size class, with the region's slab lock taken.
+ * @param region Shared memory region
+ * @param cls    Size class
+ * @param cache  Cache receiving the carved segments
+ * @return Whether the chunk could be allocated
+**/
+static bool slab_carve(struct region* region, size_t cls, std::vector<struct segment*>& cache) {
+    size_t obj_align = region->align < slab_align ? slab_align : region->align;
+    size_t capacity  = (size_t) 1 << cls;
+#ifdef LAYOUT_AOS
+    size_t cells     = round_up(sizeof(struct segment), obj_align);
+    size_t obj_size  = round_up(cells + (capacity >> region->align_shift) * region->cell_size, obj_align);
+#else
+    size_t nbblocks  = ((capacity - 1) >> region->block_shift) + 1;
+    size_t copy      = round_up(sizeof(struct segment) + nbblocks * sizeof(struct block), obj_align);
+    size_t words     = round_up(copy + capacity, alignof(struct word));
+    size_t obj_size  = round_up(words + (capacity >> region->align_shift) * sizeof(struct word), obj_align);
+#endif
+    size_t min_size  = region->huge == huge_none ? slab_chunk : huge_page;
+    size_t count     = obj_size < min_size ? min_size / obj_size : 1;
+    region->chunks.reserve(region->chunks.size() + 1);
+    cache.reserve(cache.size() + count);
+    char* start = chunk_map(region, count * obj_size, obj_align);
+    if (unlikely(!start))
+        return false;
+    for (size_t i = 0; i < count; ++i) {
+        char* obj = start + i * obj_size;
+        struct segment* seg = new (obj) struct segment(); // The rest, block table included, is zero from the mapping
+#ifdef LAYOUT_AOS
+        seg->cells     = obj + cells;
+#else
+        seg->copy      = obj + copy;
+        seg->words     = (struct word*) (obj + words);
+#endif
+        seg->cls       = cls;
+        cache.push_back(seg);
+    }
+    return true;
+}
+
+/** Take a free segment of the given size class for the calling thread.
+ * @param region Shared memory region
+ * @param cls    Size class
+ * @return Free segment, 'NULL' on failure
+**/
+static struct segment* slab_take(struct region* region, size_t cls) {
+    auto mag = magazine_of(region);
+    if (unlikely(!mag))
+        return NULL;
+    auto& cache = mag[cls];
+    if (cache.empty()) {
+        std::unique_lock<std::mutex> guard{region->slab_lock};
+        auto& depot = region->depots[cls];
+        if (!depot.empty()) {
+            size_t count = depot.size() < slab_batch ? depot.size() : slab_batch;
+            cache.insert(cache.end(), depot.end() - count, depot.end());
+            depot.resize(depot.size() - count);
+        } else if (unlikely(!slab_carve(region, cls, cache))) {
+            return NULL;
+        }
+    }
+    struct segment* seg = cache.back();
+    cache.pop_back();
+    return seg;
+}
+
+/** Give back a segment taken by the calling thread, but not handed out or only to a transaction that aborted.
+ * @param region Shared memory region
+ * @param seg    Segment to recycle
+**/
+static void slab_recycle(struct region* region, struct segment* seg) {
+    // Only popped from this magazine before, so pushing it back cannot reallocate
+    magazine_of(region)[seg->cls].push_back(seg);
+}
+
+/** Zero the given range of a slab object, handing its whole pages back to the kernel if it is large.
+ * @param region Shared memory region
+ * @param addr   Start of the range
+ * @param size   Size of the range (in bytes)
+**/
+static void slab_zero(struct region* region, void* addr, size_t size) {
+    if (size >= slab_madvise) {
+        // Whole (huge) pages only, so that huge pages are not split
+        size_t page     = chunk_page(region);
+        uintptr_t start = round_up((uintptr_t) addr, page);
+        uintptr_t end   = ((uintptr_t) addr + size) & ~(page - 1);
+        // Private anonymous pages read as zero again once dropped
+        if (start < end && madvise((void*) start, end - start, MADV_DONTNEED) == 0) {
+            memset(addr, 0, start - (uintptr_t) addr);
+            memset((void*) end, 0, (uintptr_t) addr + size - end);
+            return;
+        }
+    }
+    memset(addr, 0, size);
+}
+
+/** Allocate a zero-initialized segment, and register it in the segment table.
+ * @param region Shared memory region
+ * @param size   Size of the segment (in bytes), a positive multiple of the alignment
+ * @return Allocated segment, 'NULL' on failure
+**/
+static struct segment* segment_alloc(struct region* region, size_t size) {
+    size_t cls = slab_class(region, size);
+    if (unlikely(cls >= addr_shift))
+        return NULL;
+    struct segment* seg;
+    try {
+        seg = slab_take(region, cls);
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+    if (unlikely(!seg))
+        return NULL;
+    if (seg->id == 0) {
+        // Take a deallocated id if any, otherwise a new one. Ids are only pushed
+        // back when no transaction runs, so concurrent pops cannot suffer ABA.
+        uint32_t id;
+        uint32_t count = region->free_count.load(std::memory_order_relaxed);
+        do {
+            if (count == 0) {
+                id = region->next_id.fetch_add(1, std::memory_order_relaxed);
+                if (unlikely(id >= max_segments)) {
+                    slab_recycle(region, seg);
+                    return NULL;
+                }
+                break;
+            }
+            id = region->free_ids[count - 1];
+        } while (!region->free_count.compare_exchange_weak(count, count - 1, std::memory_order_relaxed));
+        seg->id = id;
+    }
+    if (seg->used) {
+#ifdef LAYOUT_AOS
+        slab_zero(region, seg->cells, (size >> region->align_shift) * region->cell_size);
+#else
+        // The blocks of copy B left materialized by a previous use are not read
+        // before being written again, every word having copy A readable
+        slab_zero(region, seg->copy, size);
+        slab_zero(region, seg->words, (size >> region->align_shift) * sizeof(struct word));
+#endif
+    }
+    seg->used = true;
+    seg->freed.store(false, std::memory_order_relaxed);
+    seg->size = size;
+    region->segments[seg->id].store(seg, std::memory_order_release);
+    return seg;
+}
+
+/** Deregister the given segment and recycle it to the depot, no transaction running.
+ * @param region Shared memory region
+ * @param seg    Segment to free
+**/
+static void segment_free(struct region* region, struct segment* seg) {
+    region->segments[seg->id].store(NULL, std::memory_order_relaxed);
+    uint32_t count = region->free_count.load(std::memory_order_relaxed);
+    region->free_ids[count] = seg->id;
+    region->free_count.store(count + 1, std::memory_order_relaxed);
+    seg->id = 0;
+    std::unique_lock<std::mutex> guard{region->slab_lock};
+    region->depots[seg->cls].push_back(seg);
+}
+
+#ifndef LAYOUT_AOS
+static_assert(sizeof(struct segment) % alignof(struct block) == 0, "the block table of copy B follows the segment header");
+
+/** Get the block table of copy B of the given segment.
+ * @param seg Segment
+ * @return Block table
+**/
+static inline struct block* blocks_of(struct segment* seg) {
+    return (struct block*) (seg + 1);
+}
+
+/** Get the binary logarithm of the size of a block of copy B, except for the last block of a small segment.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @return Binary logarithm of the size of a block
+**/
+template<size_t Align> static inline size_t block_shift(struct region* region) {
+    if (Align == 0)
+        return region->block_shift;
+    return Align > ((size_t) 1 << lazy_block_shift) ? __builtin_ctzl(Align) : lazy_block_shift;
+}
+
+/** Get the size of the blocks of copy B of the given segment.
+ * @param region Shared memory region
+ * @param seg    Segment
+ * @return Size of a block (in bytes)
+**/
+static inline size_t block_size(struct region* region, struct segment* seg) {
+    return seg->cls < region->block_shift ? (size_t) 1 << seg->cls : (size_t) 1 << region->block_shift;
+}
+
+/** Materialize the given block of copy B, unless another transaction did meanwhile.
+ * @param region Shared memory region
+ * @param seg    Segment of the block
+ * @param b      Block to materialize
+ * @return Block of copy B, 'NULL' on failure
+**/
+static char* block_materialize(struct region* region, struct segment* seg, struct block* b) {
+    std::unique_lock<std::mutex> guard{region->blocks_lock};
+    char* copy = b->copy.load(std::memory_order_relaxed);
+    if (copy)
+        return copy;
+    if (unlikely(posix_memalign((void**) &copy, region->align < slab_align ? slab_align : region->align, block_size(region, seg)) != 0))
+        return NULL;
+    try {
+        region->blocks.push_back(lazy_block{seg, (size_t) (b - blocks_of(seg))});
+    } catch (const std::bad_alloc&) {
+        free(copy);
+        return NULL;
+    }
+    b->copy.store(copy, std::memory_order_release);
+    return copy;
+}
+
+/** Get the copy B of the given word for a write, materializing its block if needed, and mark the block as hot.
+ * @param region Shared memory region
+ * @param seg    Segment of the word
+ * @param offset Offset of the word in its segment (in bytes)
+ * @return Address of copy B of the word, 'NULL' on failure
+**/
+static inline char* block_touch(struct region* region, struct segment* seg, size_t offset) {
+    struct block* b = &(blocks_of(seg)[offset >> region->block_shift]);
+    char* copy = b->copy.load(std::memory_order_acquire);
+    if (unlikely(!copy)) {
+        copy = block_materialize(region, seg, b);
+        if (unlikely(!copy))
+            return NULL;
+    }
+    if (!b->hot.load(std::memory_order_relaxed)) // Avoid bouncing the line on every write
+        b->hot.store(true, std::memory_order_relaxed);
+    return copy + (offset & (((size_t) 1 << region->block_shift) - 1));
+}
+
+/** Free the cold blocks of copy B, after copying their readable words back to copy A, no transaction running.
+ * @param region Shared memory region
+**/
+static void blocks_sweep(struct region* region) {
+    std::unique_lock<std::mutex> guard{region->blocks_lock};
+    size_t size = region->align;
+    size_t kept = 0;
+    for (auto entry: region->blocks) {
+        struct segment* seg = entry.seg;
+        struct block* b = &(blocks_of(seg)[entry.index]);
+        if (b->hot.load(std::memory_order_relaxed)) {
+            b->hot.store(false, std::memory_order_relaxed);
+            region->blocks[kept++] = entry;
+            continue;
+        }
+        char* copy = b->copy.load(std::memory_order_relaxed);
+        size_t offset = entry.index << region->block_shift;
+        struct word* words = &(seg->words[offset >> region->align_shift]);
+        size_t count = block_size(region, seg) >> region->align_shift;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t control = words[i].control.load(std::memory_order_relaxed);
+            if (control & valid_bit) {
+                memcpy(seg->copy + offset + i * size, copy + i * size, size);
+                words[i].control.store(control ^ valid_bit, std::memory_order_relaxed);
+            }
+        }
+        b->copy.store(NULL, std::memory_order_relaxed);
+        free(copy);
+    }
+    region->blocks.resize(kept);
+}
+#endif
+
+/** Close the window of the adaptive mode if it holds enough samples, and switch modes if its metrics ask for it.
+ * @param region Shared memory region, at the end of an epoch with 'logs_lock' held
+**/
+static void adapt_check(struct region* region) {
+    struct adapt_state* adapt = &(region->adapt);
+    struct tx_stats total{0, 0, 0, 0};
+    for (auto log: region->logs) {
+        total.commits     += log->stats.commits;
+        total.aborts      += log->stats.aborts;
+        total.irrevocable += log->stats.irrevocable;
+        total.reads       += log->stats.reads;
+    }
+    uint64_t commits = total.commits - adapt->base.commits;
+    uint64_t aborts  = total.aborts - adapt->base.aborts;
+    uint64_t attempts = commits + aborts;
+    if (attempts < adapt_samples)
+        return;
+    uint64_t reads = total.reads - adapt->base.reads;
+    uint64_t optimistic = attempts - (total.irrevocable - adapt->base.irrevocable);
+    uint64_t aborted = 100 * aborts / attempts;
+    uint64_t readers = 100 * reads / (reads + commits);
+    uint64_t footprint = optimistic > 0 ? adapt->footprint / optimistic : 0;
+    adapt->base = total;
+    adapt->footprint = 0;
+    ++adapt->windows;
+    int mode = adapt->mode.load(std::memory_order_relaxed);
+    if (mode == mode_optimistic) {
+        if (aborted < adapt->aborts_high || readers >= adapt_readers)
+            return;
+        // A probe failing right away makes the next serial mode longer
+        adapt->hold = adapt->windows == 1 ? (2 * adapt->hold < adapt_hold_max ? 2 * adapt->hold : adapt_hold_max) : 1;
+        mode = mode_serial;
+    } else {
+        if (adapt->windows < adapt->hold)
+            return;
+        mode = mode_optimistic;
+    }
+    if (mode == mode_serial) {
+        fprintf(stderr, "tm: serial mode for %lu windows, after a window of %lu read-write attempts (%lu%% aborted), %lu%% read-only transactions, %lu words per attempt\n", (unsigned long) adapt->hold, (unsigned long) attempts, (unsigned long) aborted, (unsigned long) readers, (unsigned long) footprint);
+    } else {
+        fprintf(stderr, "tm: optimistic mode, after %lu windows in serial mode, the last of %lu read-write transactions, %lu%% read-only transactions\n", (unsigned long) adapt->windows, (unsigned long) attempts, (unsigned long) readers);
+    }
+    adapt->windows = 0;
+    adapt->mode.store(mode, std::memory_order_relaxed);
+}
+
+/** Run the epoch-end work: commit the written words and free the segments, no transaction running.
+ * @param region Shared memory region
+**/
+static void epoch_commit(struct region* region) {
+    std::unique_lock<std::mutex> logs_guard{region->logs_lock};
+    for (auto log: region->logs) {
+        region->adapt.footprint += log->written.size() + log->accessed.size();
+        for (auto w: log->written)
+            w->control.store((w->control.load(std::memory_order_relaxed) & valid_bit) ^ valid_bit, std::memory_order_relaxed);
+        for (auto w: log->accessed)
+            w->control.store(w->control.load(std::memory_order_relaxed) & valid_bit, std::memory_order_relaxed);
+        log->written.clear();
+        log->accessed.clear();
+    }
+    if (region->adapt.enabled && ++region->adapt.epochs % adapt_period == 0)
+        adapt_check(region);
+    logs_guard.unlock();
+    std::vector<struct segment*> pending;
+    {
+        std::unique_lock<std::mutex> guard{region->pending_lock};
+        pending.swap(region->pending);
+    }
+    for (auto seg: pending)
+        segment_free(region, seg);
+#ifndef LAYOUT_AOS
+    if (++region->epochs % lazy_period == 0)
+        blocks_sweep(region);
+#endif
+}
+
+/** Take a descriptor from the pool of the calling thread, growing it if empty.
+ * @return Transaction descriptor, 'NULL' on failure
+**/
+static struct transaction* tx_acquire() {
+    struct tx_pool* pool = &tx_local;
+    struct transaction* tx = pool->free;
+    if (likely(tx)) {
+        pool->free = tx->next;
+        return tx;
+    }
+    tx = new (std::nothrow) struct transaction;
+    if (unlikely(!tx))
+        return NULL;
+    try {
+        pool->all.push_back(tx);
+    } catch (const std::bad_alloc&) {
+        delete tx;
+        return NULL;
+    }
+    tx->log        = NULL;
+    tx->generation = 0;
+    return tx;
+}
+
+/** Give the descriptor of an ended transaction back to the pool of the calling thread, invalidating its identifier.
+ * @param tx Transaction descriptor
+**/
+static inline void tx_release(struct transaction* tx) {
+    struct tx_pool* pool = &tx_local;
+    ++tx->generation;
+    tx->next   = pool->free;
+    pool->free = tx;
+}
+
+/** Get the identifier of the given transaction.
+ * @param tx Transaction descriptor
+ * @return Opaque transaction ID
+**/
+static inline tx_t tx_id(struct transaction* tx) {
+    return (uintptr_t) tx | ((uintptr_t) tx->generation << tx_generation_shift);
+}
+
+/** Get the descriptor of the given transaction identifier.
+ * @param tx Opaque transaction ID
+ * @return Transaction descriptor, 'NULL' if the transaction already ended
+**/
+static inline struct transaction* tx_of(tx_t tx) {
+    struct transaction* t = (struct transaction*) (tx & tx_pointer_mask);
+    return likely(t->generation == (uint16_t) (tx >> tx_generation_shift)) ? t : NULL;
+}
+
+/** Leave the epoch, running the epoch-end work if last.
+ * @param region Shared memory region
+ * @param tx     Transaction leaving
+**/
+static void tx_leave(struct region* region, struct transaction* tx) {
+    if (leave_epoch(&(region->batcher), tx->is_ro)) {
+        epoch_commit(region);
+        end_epoch(&(region->batcher));
+    }
+}
+
+/** Abort the given transaction: roll back its writes and allocations, then leave the epoch.
+ * @param region Shared memory region
+ * @param tx     Transaction to abort
+**/
+static void tx_abort(struct region* region, struct transaction* tx) {
+    if (!tx->is_ro) {
+        for (auto w: tx->log->written)
+            w->control.store(w->control.load(std::memory_order_relaxed) & valid_bit, std::memory_order_relaxed);
+        tx->log->written.clear();
+        // The registered reads stay logged, to be reset with the others, but
+        // the ones still ours alone are released now for waiting transactions
+        uint64_t self = (uintptr_t) tx->log;
+        for (auto w: tx->log->accessed) {
+            uint64_t control = w->control.load(std::memory_order_relaxed);
+            if ((control & access_mask) == self)
+                w->control.compare_exchange_strong(control, control & valid_bit, std::memory_order_relaxed);
+        }
+        cm_abort(tx->policy, &(tx->log->cm));
+        ++tx->log->stats.aborts;
+    }
+    for (auto seg: tx->allocs)
+        slab_recycle(region, seg);
+    for (auto seg: tx->frees)
+        seg->freed.store(false, std::memory_order_relaxed);
+    tx->log->live = false;
+    tx_leave(region, tx);
+    if (unlikely(tx->is_irrevocable)) // Not reached through the interface, but never leak the lock
+        region->irrevocable_lock.unlock();
+    tx_release(tx);
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Get the size of a word.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @return Size of a word (in bytes)
+**/
+template<size_t Align> static inline size_t word_size(struct region* region) {
+    return Align ? Align : region->align;
+}
+
+/** Get the control block of the given word.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @param seg    Segment of the word
+ * @param index  Index of the word in its segment
+ * @return Control block of the word
+**/
+template<size_t Align> static inline struct word* word_at(struct region* unused(region), struct segment* seg, size_t index) {
+#ifdef LAYOUT_AOS
+    size_t cell_size = Align ? round_up(sizeof(struct word) + 2 * Align, alignof(struct word)) : region->cell_size;
+    return (struct word*) (seg->cells + index * cell_size);
+#else
+    return &(seg->words[index]);
+#endif
+}
+
+/** Get the address of one copy of the given word.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @param seg    Segment of the word
+ * @param index  Index of the word in its segment
+ * @param copy   Copy to get, 0 for copy A and 1 for copy B
+ * @return Address of the copy
+**/
+template<size_t Align> static inline void* copy_at(struct region* region, struct segment* seg, size_t index, int copy) {
+#ifdef LAYOUT_AOS
+    return (char*) word_at<Align>(region, seg, index) + sizeof(struct word) + copy * word_size<Align>(region);
+#else
+    // Both addresses are computed, so that the copy is selected without a
+    // branch (the block of copy B is materialized if the word is in it)
+    size_t offset = index * word_size<Align>(region);
+    size_t shift  = block_shift<Align>(region);
+    uintptr_t in_a = (uintptr_t) seg->copy + offset;
+    uintptr_t in_b = (uintptr_t) blocks_of(seg)[offset >> shift].copy.load(std::memory_order_acquire) + (offset & (((size_t) 1 << shift) - 1));
+    return (void*) (in_a ^ ((in_a ^ in_b) & -(uintptr_t) copy));
+#endif
+}
+
+/** Handle a conflict on a word with the single other transaction in its access set, as the contention policy decides.
+ * @param tx     Transaction to use
+ * @param w      Control block of the word
+ * @param access Access set of the word, naming the enemy
+ * @return Whether the enemy released the word, otherwise the transaction must abort
+**/
+__attribute__((noinline)) static bool contend(struct transaction* tx, struct word* w, uint64_t access) {
+    struct cm_state* self = &(tx->log->cm);
+    struct cm_state* enemy = &(((struct epoch_log*) (access & ~written_bit))->cm);
+    for (unsigned int round = 0;; ++round) {
+        uint64_t status;
+        int decision = cm_resolve(tx->policy, self, enemy, round, &status);
+        if (decision == cm_abort_self || (decision == cm_kill_enemy && !cm_kill(enemy, status)))
+            return false;
+        // A killed enemy releases its words when it aborts, otherwise its
+        // attempt may end with a commit, keeping them until the epoch ends
+        size_t patience = decision == cm_kill_enemy ? SIZE_MAX : cm_patience(tx->policy, round);
+        for (size_t poll = 0; poll < patience; ++poll) {
+            if ((w->control.load(std::memory_order_acquire) & access_mask) != access)
+                return true;
+            if (cm_killed(self))
+                return false;
+            if (cm_over(enemy, status))
+                return (w->control.load(std::memory_order_acquire) & access_mask) != access;
+            cm_pause(poll);
+        }
+    }
+}
+
+/** Count a registration of a word for the contention policy.
+ * @param tx Transaction to use
+**/
+static inline void count_work(struct transaction* tx) {
+    std::atomic<uint64_t>* work = &(tx->log->cm.work);
+    work->store(work->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+/** Register a read of a word in the given read-write transaction.
+ * @param tx Transaction to use
+ * @param w  Control block of the word
+ * @return Copy to read (0 for copy A, 1 for copy B), -1 if the transaction must abort
+**/
+static inline int register_read(struct transaction* tx, struct word* w) {
+    uint64_t control = w->control.load(std::memory_order_acquire);
+    uint64_t self = (uintptr_t) tx->log;
+    while (true) {
+        int readable = control & valid_bit ? 1 : 0;
+        uint64_t access = control & access_mask;
+        if (access & written_bit) {
+            if (access == (self | written_bit))
+                return readable ^ 1; // Our own write, in the writable copy
+            if (!contend(tx, w, access))
+                return -1;
+            control = w->control.load(std::memory_order_acquire);
+            continue;
+        }
+        if (access == self || access == multi_access)
+            return readable;
+        uint64_t next = access == no_access ? self : multi_access;
+        if (w->control.compare_exchange_weak(control, (control & valid_bit) | next, std::memory_order_acq_rel)) {
+            if (next == self) { // Otherwise logged by the transaction that registered first
+                tx->log->accessed.push_back(w);
+                count_work(tx);
+            }
+            return readable;
+        }
+    }
+}
+
+/** Register a write of a word in the given transaction.
+ * @param tx Transaction to use
+ * @param w  Control block of the word
+ * @return Copy to write (0 for copy A, 1 for copy B), -1 if the transaction must abort
+**/
+static inline int register_write(struct transaction* tx, struct word* w) {
+    uint64_t self = (uintptr_t) tx->log;
+    uint64_t control = w->control.load(std::memory_order_acquire);
+    if ((control & access_mask) != (self | written_bit)) {
+        do {
+            uint64_t access = control & access_mask;
+            if (access != no_access && access != self) { // Accessed by another transaction
+                // Several readers cannot be told apart, nor waited for
+                if (access == multi_access || !contend(tx, w, access))
+                    return -1;
+                control = w->control.load(std::memory_order_acquire);
+                continue;
+            }
+        } while (!w->control.compare_exchange_weak(control, (control & valid_bit) | self | written_bit, std::memory_order_acq_rel));
+        tx->log->written.push_back(w);
+        count_work(tx);
+    }
+    return control & valid_bit ? 0 : 1;
+}
+
+/** Read a word in the given transaction.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param IsRo   Whether the transaction is read-only
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param seg    Segment of the word
+ * @param index  Index of the word in its segment
+ * @param target Target address (in a private region)
+ * @return Whether the transaction can continue
+**/
+template<size_t Align, bool IsRo> static inline bool read_word(struct region* region, struct transaction* tx, struct segment* seg, size_t index, void* target) {
+    struct word* w = word_at<Align>(region, seg, index);
+    int copy;
+    if (IsRo) {
+        copy = w->control.load(std::memory_order_acquire) & valid_bit ? 1 : 0;
+    } else {
+        copy = register_read(tx, w);
+        if (unlikely(copy < 0))
+            return false;
+    }
+    memcpy(target, copy_at<Align>(region, seg, index, copy), word_size<Align>(region));
+    return true;
+}
+
+/** Write a word in the given transaction.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param seg    Segment of the word
+ * @param index  Index of the word in its segment
+ * @param source Source address (in a private region)
+ * @return Whether the transaction can continue
+**/
+template<size_t Align> static inline bool write_word(struct region* region, struct transaction* tx, struct segment* seg, size_t index, void const* source) {
+    int copy = register_write(tx, word_at<Align>(region, seg, index));
+    if (unlikely(copy < 0))
+        return false;
+#ifndef LAYOUT_AOS
+    // Materialize copy B if needed, and keep it hot while one copy is written
+    char* in_b = block_touch(region, seg, index * word_size<Align>(region));
+    if (unlikely(!in_b))
+        return false;
+    memcpy(copy ? in_b : copy_at<Align>(region, seg, index, 0), source, word_size<Align>(region));
+#else
+    memcpy(copy_at<Align>(region, seg, index, copy), source, word_size<Align>(region));
+#endif
+    return true;
+}
+
+/**
+ * @brief Bulk path of the run kernels (SoA layout only).
+ *
+ * A run of at least 'bulk_words' words skips the per-word path. Read-only
+ * transactions (whose readable copies do not change during the epoch) read
+ * 8-byte words in SIMD batches, blending both copies by their control words.
+ * Otherwise, the copy to read of each word of a chunk of 64 is gathered in a
+ * bitmap, in SIMD batches for read-only transactions, or by registering each
+ * word first for read-write ones, then the chunk is copied without touching
+ * the control blocks again (at once if copy A is readable everywhere). A write
+ * copies the whole run at once, block by block of copy B, if every word is
+ * written in the same copy (the other copy of a word must not be overwritten).
+ */
+static const size_t bulk_words = 4;
+
+#ifndef LAYOUT_AOS
+/** Read a chunk of words, given the copy to read each word from.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @param seg    Segment of the words
+ * @param index  Index of the first word in its segment
+ * @param count  Number of words, at most 64
+ * @param in_b   Bit 'i' set if word 'i' is to be read from copy B, otherwise from copy A
+ * @param target Target address (in a private region)
+**/
+template<size_t Align> static inline void read_chunk(struct region* region, struct segment* seg, size_t index, size_t count, uint64_t in_b, void* target) {
+    size_t size = word_size<Align>(region);
+    if (in_b == 0) { // Common case on read-mostly data, copy B may not even be materialized
+        memcpy(target, seg->copy + index * size, count * size);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i)
+        memcpy((char*) target + i * size, copy_at<Align>(region, seg, index + i, (in_b >> i) & 1), size);
+}
+#endif
+
+#ifndef LAYOUT_AOS
+/** Read a run of at least 'bulk_words' words in the given transaction.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param IsRo   Whether the transaction is read-only
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param seg    Segment of the words
+ * @param index  Index of the first word in its segment
+ * @param count  Number of words
+ * @param target Target address (in a private region)
+ * @return Whether the transaction can continue
+**/
+template<size_t Align, bool IsRo> __attribute__((noinline)) static bool read_bulk(struct region* region, struct transaction* tx, struct segment* seg, size_t index, size_t count, void* target) {
+    // Not inlined, so that the (common) single word reads need no stack frame
+    struct word* words = &(seg->words[index]);
+    if (IsRo && Align == sizeof(uint64_t)) {
+        // Block by block of copy B, read from copy A alone where not materialized
+        size_t block = (size_t) 1 << block_shift<Align>(region);
+        for (size_t done = 0; done < count;) {
+            size_t offset = (index + done) * Align;
+            size_t span = (block - (offset & (block - 1))) / Align;
+            span = span < count - done ? span : count - done;
+            char const* in_b = blocks_of(seg)[offset >> block_shift<Align>(region)].copy.load(std::memory_order_acquire);
+            if (in_b) {
+                select_words((std::atomic<uint64_t> const*) (words + done), seg->copy + offset, in_b + (offset & (block - 1)), span, valid_bit, (char*) target + done * Align);
+            } else {
+                memcpy((char*) target + done * Align, seg->copy + offset, span * Align);
+            }
+            done += span;
+        }
+        return true;
+    }
+    for (size_t done = 0; done < count; done += 64) {
+        size_t chunk = count - done < 64 ? count - done : 64;
+        uint64_t in_b = 0;
+        if (IsRo) {
+            in_b = scan_bits((std::atomic<uint64_t> const*) (words + done), chunk, valid_bit);
+        } else {
+            for (size_t i = 0; i < chunk; ++i) {
+                int copy = register_read(tx, &(words[done + i]));
+                if (unlikely(copy < 0))
+                    return false;
+                in_b |= (uint64_t) copy << i;
+            }
+        }
+        read_chunk<Align>(region, seg, index + done, chunk, in_b, (char*) target + done * word_size<Align>(region));
+    }
+    return true;
+}
+#endif
+
+/** Read a run of words in the given transaction.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param IsRo   Whether the transaction is read-only
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param seg    Segment of the words
+ * @param index  Index of the first word in its segment
+ * @param count  Number of words
+ * @param target Target address (in a private region)
+ * @return Whether the transaction can continue
+**/
+template<size_t Align, bool IsRo> static bool read_words(struct region* region, struct transaction* tx, struct segment* seg, size_t index, size_t count, void* target) {
+#ifndef LAYOUT_AOS
+    if (count >= bulk_words)
+        return read_bulk<Align, IsRo>(region, tx, seg, index, count, target);
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        if (unlikely(!(read_word<Align, IsRo>(region, tx, seg, index + i, (char*) target + i * word_size<Align>(region)))))
+            return false;
+    }
+    return true;
+}
+
+/** Write a run of words in the given transaction.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param seg    Segment of the words
+ * @param index  Index of the first word in its segment
+ * @param count  Number of words
+ * @param source Source address (in a private region)
+ * @return Whether the transaction can continue
+**/
+template<size_t Align> static bool write_words(struct region* region, struct transaction* tx, struct segment* seg, size_t index, size_t count, void const* source) {
+#ifndef LAYOUT_AOS
+    if (count >= bulk_words) {
+        struct word* words = &(seg->words[index]);
+        int copy = register_write(tx, &(words[0]));
+        if (unlikely(copy < 0))
+            return false;
+        bool uniform = true;
+        for (size_t i = 1; i < count; ++i) {
+            int next = register_write(tx, &(words[i]));
+            if (unlikely(next < 0))
+                return false;
+            uniform = uniform && next == copy;
+        }
+        if (uniform) {
+            size_t size  = word_size<Align>(region);
+            size_t block = (size_t) 1 << block_shift<Align>(region);
+            for (size_t done = 0; done < count;) {
+                size_t offset = (index + done) * size;
+                size_t span = (block - (offset & (block - 1))) / size;
+                span = span < count - done ? span : count - done;
+                char* in_b = block_touch(region, seg, offset);
+                if (unlikely(!in_b))
+                    return false;
+                memcpy(copy ? in_b : seg->copy + offset, (char const*) source + done * size, span * size);
+                done += span;
+            }
+            return true;
+        }
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        if (unlikely(!write_word<Align>(region, tx, seg, index + i, (char const*) source + i * word_size<Align>(region))))
+            return false;
+    }
+    return true;
+}
+
+/** Write a run of words in place in an irrevocable transaction, alone in its epoch.
+ * @param Align  Size of a word (in bytes), 0 if only known at runtime
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param seg    Segment of the words
+ * @param index  Index of the first word in its segment
+ * @param count  Number of words
+ * @param source Source address (in a private region)
+ * @return Whether the transaction can continue (always)
+**/
+template<size_t Align> static bool write_inplace(struct region* region, struct transaction* unused(tx), struct segment* seg, size_t index, size_t count, void const* source) {
+    size_t size = word_size<Align>(region);
+    for (size_t i = 0; i < count; ++i) {
+        // The readable copy, which no other transaction reads in the epoch
+        int copy = word_at<Align>(region, seg, index + i)->control.load(std::memory_order_relaxed) & valid_bit ? 1 : 0;
+        memcpy(copy_at<Align>(region, seg, index + i, copy), (char const*) source + i * size, size);
+    }
+    return true;
+}
+
+template<size_t Align> static constexpr struct kernels kernels_for = {read_words<Align, true>, read_words<Align, false>, write_words<Align>, write_inplace<Align>};
+
+/** Get the word kernels for the given alignment.
+ * @param align Size of a word (in bytes)
+ * @return Word kernels, specialized for the alignment if it is at most 64 bytes
+**/
+static struct kernels const* kernels_of(size_t align) {
+    switch (align) {
+        case 1:  return &kernels_for<1>;
+        case 2:  return &kernels_for<2>;
+        case 4:  return &kernels_for<4>;
+        case 8:  return &kernels_for<8>;
+        case 16: return &kernels_for<16>;
+        case 32: return &kernels_for<32>;
+        case 64: return &kernels_for<64>;
+        default: return &kernels_for<0>;
+    }
+}
+
+// -------------------------------------------------------------------------- //
 
 /** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
  * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
  * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
  * @return Opaque shared memory region handle, 'invalid_shared' on failure
 **/
-shared_t tm_create(size_t size, size_t align) {
-    std::cout << "tm_create" << std::endl;
-    struct region* region = (struct region*) malloc(sizeof(struct region));
+shared_t tm_create(size_t size, size_t align) noexcept {
+    struct region* region = new (std::nothrow) struct region;
     if (unlikely(!region)) {
         return invalid_shared;
     }
-    // We allocate the shared memory buffer such that its words are correctly
-    // aligned.
-    // int ret = 0;
-    // if (ret = posix_memalign(&(region->start), align, size) != 0) {
-    //     free(region);
-    //     // posix_memalign failed
-    //     if (ret == EINVAL) {
-    //         printf("The alignment argument is not a power of two multiple of sizeof(void*)\n");
-    //     } else if (ret == ENOMEM) {
-    //         printf("Insufficient memory to fulfill the request\n");
-    //     } else {
-    //         printf("Unknown error\n");
-    //     }
-    //     return invalid_shared;
-    // }
-    memset(region->start, 0, size);
-    region->allocs      = static_cast<Alloc>(NULL);
+    region->segments = (std::atomic<struct segment*>*) calloc(max_segments, sizeof(std::atomic<struct segment*>));
+    if (unlikely(!region->segments)) {
+        delete region;
+        return invalid_shared;
+    }
+    region->free_ids = (uint16_t*) malloc(max_segments * sizeof(uint16_t));
+    if (unlikely(!region->free_ids)) {
+        free(region->segments);
+        delete region;
+        return invalid_shared;
+    }
+    region->next_id.store(1, std::memory_order_relaxed); // Id 0 is never used
+    region->free_count.store(0, std::memory_order_relaxed);
     region->size        = size;
     region->align       = align;
+    region->align_shift = __builtin_ctzl(align);
+    region->page_size   = sysconf(_SC_PAGESIZE);
+    region->huge        = huge_mode_of();
+    region->hugetlb_failed = false;
+    region->kernels     = kernels_of(align);
+    region->policy      = cm_policy_of();
+    char const* env = getenv("TM_IRREVOCABLE_AFTER");
+    region->irrevocable_after = env && env[0] != '\0' ? strtoull(env, NULL, 10) : irrevocable_after;
+    env = getenv("TM_IRREVOCABLE_DRAIN");
+    region->irrevocable_kill  = env && strcmp(env, "kill") == 0;
+    env = getenv("TM_STATS");
+    region->stats       = env && env[0] != '\0' && strcmp(env, "0") != 0;
+    env = getenv("TM_ADAPT");
+    region->adapt.enabled     = env && env[0] != '\0' && strcmp(env, "0") != 0;
+    env = getenv("TM_ADAPT_ABORTS");
+    region->adapt.aborts_high = env && env[0] != '\0' ? strtoull(env, NULL, 10) : adapt_aborts;
+    region->adapt.mode.store(mode_optimistic, std::memory_order_relaxed);
+    region->adapt.epochs    = 0;
+    region->adapt.footprint = 0;
+    region->adapt.base      = tx_stats{0, 0, 0, 0};
+    region->adapt.windows   = 0;
+    region->adapt.hold      = 1;
+#ifdef LAYOUT_AOS
+    region->cell_size   = round_up(sizeof(struct word) + 2 * align, alignof(struct word));
+#else
+    region->epochs      = 0;
+    region->block_shift = region->align_shift > lazy_block_shift ? region->align_shift : lazy_block_shift;
+#endif
+    region->serial      = region_serial.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (unlikely(!segment_alloc(region, size))) {
+        for (auto log: region->logs)
+            delete log;
+        for (auto chunk: region->chunks)
+            munmap(chunk.base, chunk.size);
+        free(region->free_ids);
+        free(region->segments);
+        delete region;
+        return invalid_shared;
+    }
+    batcher_init(&(region->batcher));
     return region;
 }
 
 /** Destroy (i.e. clean-up + free) a given shared memory region.
  * @param shared Shared memory region to destroy, with no running transaction
 **/
-void tm_destroy(shared_t shared) {
-    struct region* shared_region = (struct region*) shared;
-    try {
-        // if (shared_region->start != NULL) {
-        //     free(shared_region->start);
-        //     shared_region->start = NULL;
-        // }
-        free(shared_region);
-    } catch (const std::exception& e) {
-        perror(e.what());
-        throw;
+void tm_destroy(shared_t shared) noexcept {
+    struct region* region = (struct region*) shared;
+    if (region->stats) {
+        struct tx_stats total{0, 0, 0, 0};
+        for (auto log: region->logs) {
+            total.commits     += log->stats.commits;
+            total.aborts      += log->stats.aborts;
+            total.irrevocable += log->stats.irrevocable;
+            total.reads       += log->stats.reads;
+        }
+        fprintf(stderr, "tm: %lu read-write commits, %lu aborts, %lu irrevocable, %lu read-only commits\n", (unsigned long) total.commits, (unsigned long) total.aborts, (unsigned long) total.irrevocable, (unsigned long) total.reads);
     }
+    for (auto log: region->logs)
+        delete log;
+#ifndef LAYOUT_AOS
+    for (auto entry: region->blocks)
+        free(blocks_of(entry.seg)[entry.index].copy.load(std::memory_order_relaxed));
+#endif
+    for (auto chunk: region->chunks)
+        munmap(chunk.base, chunk.size);
+    free(region->free_ids);
+    free(region->segments);
+    delete region;
 }
 
 /** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
  * @param shared Shared memory region to query
  * @return Start address of the first allocated segment
 **/
-void* tm_start(shared_t shared) {
-    // std::cout << "tm_start" << std::endl;
-    return ((struct region*) shared)->start;
+void* tm_start(shared_t unused(shared)) noexcept {
+    return (void*) ((uintptr_t) 1 << addr_shift); // First segment, of id 1
 }
 
 /** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
  * @param shared Shared memory region to query
  * @return First allocated segment size
 **/
-size_t tm_size(shared_t shared) {
-    // std::cout << "tm_size" << std::endl;
+size_t tm_size(shared_t shared) noexcept {
     return ((struct region*) shared)->size;
 }
 
@@ -132,122 +1495,109 @@ size_t tm_size(shared_t shared) {
  * @param shared Shared memory region to query
  * @return Alignment used globally
 **/
-size_t tm_align(shared_t shared) {
-    // std::cout << "tm_align" << std::endl;
+size_t tm_align(shared_t shared) noexcept {
     return ((struct region*) shared)->align;
 }
 
+/** Kill the running read-write attempts, for an irrevocable transaction waiting for the epoch to end.
+ * @param arg Shared memory region
+**/
+static void irrevocable_drain(void* arg) {
+    struct region* region = (struct region*) arg;
+    std::unique_lock<std::mutex> guard{region->logs_lock};
+    for (auto log: region->logs) {
+        uint64_t status = log->cm.status.load(std::memory_order_acquire);
+        if (status & cm_status_running)
+            cm_kill(&(log->cm), status);
+    }
+}
+
+/** Begin an irrevocable transaction, alone in its epoch.
+ * @param region Shared memory region
+ * @param tx     Transaction descriptor of the calling thread, with its epoch log
+ * @return Opaque transaction ID
+**/
+static tx_t tx_irrevocable(struct region* region, struct transaction* tx) {
+    region->irrevocable_lock.lock();
+    tx->is_ro          = false;
+    tx->is_irrevocable = true;
+    tx->read           = region->kernels->read_ro;
+    tx->write          = region->kernels->write_inplace;
+    tx->policy         = region->policy;
+    tx->allocs.clear();
+    tx->frees.clear();
+    enter_serial(&(region->batcher), region->irrevocable_kill ? irrevocable_drain : NULL, region);
+    ++tx->log->stats.irrevocable; // Once in the epoch, read by the end of the previous one
+    return tx_id(tx);
+}
+
 /** [thread-safe] Begin a new transaction on the given shared memory region.
  * @param shared Shared memory region to start a transaction on
  * @param is_ro  Whether the transaction is read-only
  * @return Opaque transaction ID, 'invalid_tx' on failure
 **/
-tx_t tm_begin(shared_t shared, bool is_ro) {
-    std::cout << "tm_begin" << std::endl;
-    // srand(time(NULL));
-    // uint* ptr = (uint*) malloc(sizeof(uint));
-    // *ptr = rand();
-    tx_t tx = is_ro ? read_only_tx : read_write_tx;
-    if (unlikely(!tx)) {
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* tx = tx_acquire();
+    if (unlikely(!tx))
+        return invalid_tx;
+    tx->log = epoch_log_of(region);
+    if (unlikely(!tx->log || tx->log->live)) { // One transaction at a time per thread and region
+        tx_release(tx);
         return invalid_tx;
     }
-    return tx;
-} 
+    tx->log->live = true;
+    if (!is_ro) {
+        if (unlikely(region->adapt.mode.load(std::memory_order_relaxed) == mode_serial))
+            return tx_irrevocable(region, tx);
+        if (unlikely(region->irrevocable_after != 0 && tx->log->cm.aborts >= region->irrevocable_after))
+            return tx_irrevocable(region, tx);
+        cm_delay(region->policy, &(tx->log->cm));
+    }
+    tx->is_ro  = is_ro;
+    tx->is_irrevocable = false;
+    tx->read   = is_ro ? region->kernels->read_ro : region->kernels->read_rw;
+    tx->write  = region->kernels->write;
+    tx->policy = region->policy;
+    tx->allocs.clear();
+    tx->frees.clear();
+    enter_epoch(&(region->batcher), is_ro);
+    if (!is_ro)
+        cm_begin(region->policy, &(tx->log->cm));
+    return tx_id(tx);
+}
 
 /** [thread-safe] End the given transaction.
  * @param shared Shared memory region associated with the transaction
  * @param tx     Transaction to end
  * @return Whether the whole transaction committed
 **/
-bool tm_end(shared_t shared, tx_t tx) {
-    std::cout << "tm_end" << std::endl;
-    return true;
-}
-
-struct word* tm_find_word_by_index(shared_t shared, size_t index) {
-    std::cout << "tm_find_word_by_index" << std::endl;
-    struct region* shared_region = (struct region*) shared;
-    // Check if the index is within the region size
-    if (index * shared_region->align >= shared_region->size) {
-        return NULL; // Index out of bounds
-    }
-
-    // Cast the address to a word pointer and return it
-    return (struct word*)shared_region->start + index * shared_region->align;
-}
-
-bool tm_read_word(shared_t shared, size_t index, size_t size, void* target, bool is_ro) {
-    std::cout << "tm_read_word" << std::endl;
-    struct word* source = (struct word*) tm_find_word_by_index(shared, index);
-    if (source == NULL) {
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = tx_of(tx);
+    if (unlikely(!t))
         return false;
-    }
-    std::cout << source->valid << " " << source->accessed << " " << source->written << " " << source->copy_A << " " << source->copy_B << std::endl;
-    if (is_ro) {
-        // read the readable copy into target
-        * reinterpret_cast<uint*>(target) = (source->valid.load() ? static_cast<uint>(source->copy_B.load()) : static_cast<uint>(source->copy_A.load()));
-        std::cout << * (uint*)target << std::endl;
-        return true;
-    } else {
-        if (source->written) {
-            if (source->accessed) {
-                // read the writable copy into target
-                * reinterpret_cast<uint*>(target) = (source->valid.load() ? static_cast<uint>(source->copy_A.load()) : static_cast<uint>(source->copy_B.load()));
-                std::cout << * (uint*)target << std::endl;
-
-                return true;
-            } else {
-                return false;
-            }
-        } else {
-            // read the readable copy into target
-            * reinterpret_cast<uint*>(target) = (source->valid.load() ? static_cast<uint>(source->copy_B.load()) : static_cast<uint>(source->copy_A.load()));
-            std::cout << * (uint*)target << std::endl;
-
-            source->accessed.store(true);
-            return true;
+    if (!t->is_ro) {
+        if (unlikely(t->is_irrevocable)) {
+            t->log->cm.aborts = 0; // Back to optimistic attempts
+        } else if (unlikely(!cm_commit(t->policy, &(t->log->cm)))) { // Killed by a conflicting transaction
+            tx_abort(region, t);
+            return false;
         }
-    }
-    return false;
-}
-
-bool tm_write_word(shared_t shared, size_t index, void const* source, size_t size, bool is_ro) {
-    std::cout << "tm_write_word" << std::endl;
-    struct word* target = (struct word*) tm_find_word_by_index(shared, index);
-    if (target == NULL) {
-        return false;
-    }
-    if (is_ro) {
-        return false;
+        ++t->log->stats.commits;
     } else {
-        if (target->written.load()) {
-            if (target->accessed.load()) {
-                // write the writable copy
-                if (target->valid.load()) {
-                    target->copy_A.store(*(uint*)source);
-                } else {
-                    target->copy_B.store(*(uint*)source);
-                }
-                target->written.store(true);
-                return true;
-            } else return false;
-        } else {
-            if (target->accessed.load()) {
-                // if at least one other transaction is in the “access set”, abort
-                return false;
-            } else {
-                // write the writable copy
-                if (target->valid.load()) {
-                    target->copy_A.store(*(uint*)source);
-                } else {
-                    target->copy_B.store(*(uint*)source);
-                }
-                target->written.store(true);
-                target->accessed.store(true);
-                return true;
-            }
-        }
+        ++t->log->stats.reads;
     }
+    if (!t->frees.empty()) {
+        std::unique_lock<std::mutex> guard{region->pending_lock};
+        region->pending.insert(region->pending.end(), t->frees.begin(), t->frees.end());
+    }
+    t->log->live = false;
+    tx_leave(region, t);
+    if (unlikely(t->is_irrevocable))
+        region->irrevocable_lock.unlock();
+    tx_release(t);
+    return true;
 }
 
 /** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
@@ -258,22 +1608,15 @@ bool tm_write_word(shared_t shared, size_t index, void const* source, size_t siz
  * @param target Target start address (in a private region)
  * @return Whether the whole transaction can continue
 **/
-bool tm_read(shared_t shared, tx_t unused(tx), void const* unused(source), size_t size, void* target) {
-    std::cout << "tm_read" << std::endl;
-// foreach word index within [source, source + size] do
-// result = read word(word index , target + offset);
-// if result = transaction must abort then
-// return the transaction must abort;
-// end
-// end
-    struct region* shared_region = (struct region*) shared;
-    for (size_t index = 0; index * shared_region->align < shared_region->size; index++)
-    {
-        if (!tm_read_word(shared, index, size, target, true)) {
-            shared_region->allocs = Alloc::abort;
-            return false;
-        }
-        target = (uint*)target + shared_region->align;
+bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = tx_of(tx);
+    if (unlikely(!t))
+        return false;
+    struct segment* seg = segment_of(region, source);
+    if (unlikely((!t->is_ro && cm_killed(&(t->log->cm))) || !t->read(region, t, seg, index_of(region, source), size >> region->align_shift, target))) {
+        tx_abort(region, t);
+        return false;
     }
     return true;
 }
@@ -286,23 +1629,15 @@ bool tm_read(shared_t shared, tx_t unused(tx), void const* unused(source), size_
  * @param target Target start address (in the shared region)
  * @return Whether the whole transaction can continue
 **/
-bool tm_write(shared_t shared, tx_t unused(tx), void const* source, size_t size, void* target) {
-    std::cout << "tm_write" << std::endl;
-// foreach word index within [target, target + size] do
-// result = write word(source + offset, word index );
-// if result = transaction must abort then
-// return the transaction must abort;
-// end
-// end
-// return the transaction can continue;
-    struct region* shared_region = (struct region*) shared;
-    for (size_t index = 0; index * shared_region->align < shared_region->size; index++)
-    {
-        if (!tm_write_word(shared, index, source, size, false)) {
-            shared_region->allocs = Alloc::abort;
-            return false;
-        }
-        target = (uint*)target + shared_region->align;
+bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = tx_of(tx);
+    if (unlikely(!t))
+        return false;
+    struct segment* seg = segment_of(region, target);
+    if (unlikely(cm_killed(&(t->log->cm)) || !t->write(region, t, seg, index_of(region, target), size >> region->align_shift, source))) {
+        tx_abort(region, t);
+        return false;
     }
     return true;
 }
@@ -314,43 +1649,21 @@ bool tm_write(shared_t shared, tx_t unused(tx), void const* source, size_t size,
  * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
  * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
 **/
-Alloc tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) {
-    std::cout << "tm_alloc" << std::endl;
-// allocate enough space for a segment of size size;
-// if the allocation failed then
-// return the allocated failed;
-// end
-// initialize the control structure(s) (one per word) in the segment;
-// initialize each copy of each word in the segment to zeroes;
-// register the segment in the set of allocated segments;
-// return the transaction can continue;
-    size_t align = tm_align(shared);
-
-    struct region* shared_region = (struct region*) shared;
-
-    // Allocate the segment
+Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = tx_of(tx);
+    if (unlikely(!t))
+        return Alloc::abort;
+    struct segment* seg = segment_alloc(region, size);
+    if (unlikely(!seg))
+        return Alloc::nomem;
     try {
-        segment_list.push_back(shared_region);
-    } catch (const std::bad_alloc& e) { // Allocation failed
+        t->allocs.push_back(seg);
+    } catch (const std::bad_alloc&) {
+        slab_recycle(region, seg);
         return Alloc::nomem;
     }
-
-    void* segment = (void*) (shared_region->start);
-    memset(segment, 0, size);
-
-    // Initialize each align-sized block as a struct word
-    size_t num_words = size / align;
-    for (size_t i = 0; i < num_words; i++) {
-        void* addr = (char*)segment + i * align;
-        struct word* w = (struct word*)addr;
-        w->valid.store(false);
-        w->accessed.store(false);
-        w->written.store(false);
-        w->copy_A.store((size_t)malloc(align));
-        w->copy_B.store((size_t)malloc(align));
-    }
-
-    *target = segment;
+    *target = address_of(seg);
     return Alloc::success;
 }
 
@@ -360,25 +1673,37 @@ Alloc tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) {
  * @param target Address of the first byte of the previously allocated segment to deallocate
  * @return Whether the whole transaction can continue
 **/
-bool tm_free(shared_t shared, tx_t unused(tx), void* unused(target)) {
-    std::cout << "tm_free" << std::endl;
-// mark target for deregistering (from the set of allocated segments)
-// and freeing once the last transaction of the current epoch leaves
-// the Batcher, if the calling transaction ends up being committed;
-// return the transaction can continue;
-    struct region* shared_region = (struct region*) shared;
-    std::list<region*>::iterator it = std::find(segment_list.begin(), segment_list.end(), shared_region);
-    try
-    {
-        if (it != segment_list.end()) {
-            segment_list.erase(it);
-        }
+bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = tx_of(tx);
+    if (unlikely(!t))
+        return false;
+    // The segment is deregistered and freed once the last transaction of the
+    // current epoch leaves the Batcher, if the calling transaction commits.
+    // Of two transactions freeing it (each having read it still allocated),
+    // the second one aborts, as after a write-write conflict. An irrevocable
+    // transaction, alone in its epoch and already written in place, cannot
+    // abort: it can only meet a segment it freed itself (or never allocated),
+    // and such a program error leaves the free ignored.
+    struct segment* seg = segment_of(region, target);
+    if (unlikely(!seg || seg->freed.exchange(true, std::memory_order_relaxed))) {
+        if (unlikely(t->is_irrevocable))
+            return true;
+        tx_abort(region, t);
+        return false;
     }
-    catch(const std::exception& e)
-    {
+    try {
+        t->frees.push_back(seg);
+    } catch (const std::bad_alloc&) {
+        seg->freed.store(false, std::memory_order_relaxed);
+        if (unlikely(t->is_irrevocable)) // The segment stays allocated
+            return true;
+        tx_abort(region, t);
         return false;
     }
     return true;
 }
 
-#endif // TM_CPP
\ No newline at end of file
+} // namespace dualvers
+
+#endif // TM_CPP
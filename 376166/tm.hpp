@@ -32,14 +32,6 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <cstdlib>
-#include <cstring>
-#include <cassert>
-#include <iostream>
-#include <time.h>
-#include <algorithm>
-#include <atomic>
-#include <list>
 
 // -------------------------------------------------------------------------- //
 
@@ -61,31 +53,21 @@ enum class Alloc: int {
 
 // -------------------------------------------------------------------------- //
 
-shared_t tm_create(size_t size, size_t align);
-void     tm_destroy(shared_t shared);
-void*    tm_start(shared_t shared);
-size_t   tm_size(shared_t shared);
-size_t   tm_align(shared_t shared);
-tx_t     tm_begin(shared_t shared, bool read_only);
-bool     tm_end(shared_t shared, tx_t tx);
-bool     tm_read(shared_t shared, tx_t tx, void const* addr, size_t size, void* buffer);
-bool     tm_write(shared_t shared, tx_t tx, void const* addr, size_t size, void const* buffer);
-Alloc    tm_alloc(shared_t shared, tx_t tx, size_t size, void** addr);
-bool     tm_free(shared_t shared, tx_t tx, void* addr);
-
-// extern "C" {
-//     shared_t tm_create(size_t, size_t) noexcept;
-//     void     tm_destroy(shared_t) noexcept;
-//     void*    tm_start(shared_t) noexcept;
-//     size_t   tm_size(shared_t) noexcept;
-//     size_t   tm_align(shared_t) noexcept;
-//     tx_t     tm_begin(shared_t, bool) noexcept;
-//     bool     tm_end(shared_t, tx_t) noexcept;
-//     bool     tm_read(shared_t, tx_t, void const*, size_t, void*) noexcept;
-//     bool     tm_write(shared_t, tx_t, void const*, size_t, void*) noexcept;
-//     Alloc    tm_alloc(shared_t, tx_t, size_t, void**) noexcept;
-//     bool     tm_free(shared_t, tx_t, void*) noexcept;
-// }
+// The library is loaded with 'dlopen' and its symbols resolved by their C
+// names, hence the 'extern "C"' linkage of the interface.
+extern "C" {
+    shared_t tm_create(size_t, size_t) noexcept;
+    void     tm_destroy(shared_t) noexcept;
+    void*    tm_start(shared_t) noexcept;
+    size_t   tm_size(shared_t) noexcept;
+    size_t   tm_align(shared_t) noexcept;
+    tx_t     tm_begin(shared_t, bool) noexcept;
+    bool     tm_end(shared_t, tx_t) noexcept;
+    bool     tm_read(shared_t, tx_t, void const*, size_t, void*) noexcept;
+    bool     tm_write(shared_t, tx_t, void const*, size_t, void*) noexcept;
+    Alloc    tm_alloc(shared_t, tx_t, size_t, void**) noexcept;
+    bool     tm_free(shared_t, tx_t, void*) noexcept;
+}
 
 #endif // TM_HPP
 
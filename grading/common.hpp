@@ -35,6 +35,12 @@
 #include <utility>
 extern "C" {
 #include <time.h>
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
 }
 
 // -------------------------------------------------------------------------- //
@@ -199,6 +205,72 @@ public:
     }
 };
 
+/** Data TLB load miss counter class, counting for the calling thread and the threads it creates afterwards.
+**/
+class TlbCounter final: private NonCopyable {
+public:
+    /** Count class.
+    **/
+    using Count = uint_fast64_t;
+    constexpr static auto invalid_count = Count{0xbadc0de}; // Invalid count value (counter unavailable)
+private:
+    int fd; // Performance counter file descriptor, -1 if unavailable
+public:
+    /** Open the counter (stopped), unavailable on failure.
+    **/
+    TlbCounter() noexcept: fd{-1} {
+#ifdef __linux__
+        struct ::perf_event_attr attr{};
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HW_CACHE;
+        attr.config         = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled       = 1;
+        attr.inherit        = 1; // Also count in the worker threads
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    /** Close the counter.
+    **/
+    ~TlbCounter() noexcept {
+#ifdef __linux__
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+public:
+    /** Reset the counter and start counting.
+    **/
+    void start() noexcept {
+#ifdef __linux__
+        if (fd >= 0) {
+            ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    /** Stop counting.
+    **/
+    void stop() noexcept {
+#ifdef __linux__
+        if (fd >= 0)
+            ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+    /** Get the number of misses counted.
+     * @return Number of misses, 'invalid_count' if the counter is unavailable
+    **/
+    auto get_count() const noexcept {
+#ifdef __linux__
+        uint64_t count;
+        if (fd >= 0 && ::read(fd, &count, sizeof(count)) == sizeof(count))
+            return static_cast<Count>(count);
+#endif
+        return invalid_count;
+    }
+};
+
 /** Atomic waitable latch class.
 **/
 class Latch final {
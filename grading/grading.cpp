@@ -146,9 +146,10 @@ public:
  * @param maxtick_init Timeout for (re)initialization ('Chrono::invalid_tick' for none)
  * @param maxtick_perf Timeout for performance measurements ('Chrono::invalid_tick' for none)
  * @param maxtick_chck Timeout for correctness check ('Chrono::invalid_tick' for none)
+ * @param tlb          TLB miss counter, opened before the call, counting during performance measurements
  * @return Error constant null-terminated string ('nullptr' for none), execution times (in ns) (undefined if inconsistency detected)
 **/
-static auto measure(Workload& workload, unsigned int const nbthreads, unsigned int const nbrepeats, Seed seed, Chrono::Tick maxtick_init, Chrono::Tick maxtick_perf, Chrono::Tick maxtick_chck) {
+static auto measure(Workload& workload, unsigned int const nbthreads, unsigned int const nbrepeats, Seed seed, Chrono::Tick maxtick_init, Chrono::Tick maxtick_perf, Chrono::Tick maxtick_chck, TlbCounter& tlb) {
     ::std::vector<::std::thread> threads(nbthreads);
     ::std::mutex  cerrlock;        // To avoid interleaving writes to 'cerr' in case more than one thread throw
     Sync          sync{nbthreads}; // "As-synchronized-as-possible" starts so that threads interfere "as-much-as-possible"
@@ -214,15 +215,18 @@ static auto measure(Workload& workload, unsigned int const nbthreads, unsigned i
             time_init = ::std::get<Chrono>(res).get_tick();
         }
         { // Performance measurements (with cheap correctness tests)
+            tlb.start();
             for (unsigned int i = 0; i < nbrepeats; ++i) {
                 sync.master_notify();
                 auto res = sync.master_wait(maxtick_perf);
                 if (unlikely(::std::holds_alternative<char const*>(res))) {
+                    tlb.stop();
                     error = ::std::get<char const*>(res);
                     goto join;
                 }
                 times[i] = ::std::get<Chrono>(res).get_tick();
             }
+            tlb.stop();
             ::std::nth_element(times, times + posmedian, times + nbrepeats); // Partition times around the median
         }
         { // Correctness check
@@ -309,7 +313,8 @@ int main(int argc, char** argv) {
             WorkloadBank bank{tl, nbworkers, nbtxperwrk, nbaccounts, expnbaccounts, init_balance, prob_long, prob_alloc};
             try {
                 // Actual performance measurements and correctness check
-                auto res = measure(bank, nbworkers, nbrepeats, seed, maxtick_init, maxtick_perf, maxtick_chck);
+                TlbCounter tlb; // Opened before the workers start, so that they inherit it
+                auto res = measure(bank, nbworkers, nbrepeats, seed, maxtick_init, maxtick_perf, maxtick_chck, tlb);
                 // Check false negative-free correctness
                 auto error = ::std::get<0>(res);
                 if (unlikely(error)) {
@@ -337,6 +342,13 @@ int main(int argc, char** argv) {
                     ::std::cout << " -> " << (reference / perfdbl) << " speedup";
                 }
                 ::std::cout << ::std::endl;
+                ::std::cout << "⎪ dTLB load misses per TX: ";
+                if (auto const misses = tlb.get_count(); misses == TlbCounter::invalid_count) {
+                    ::std::cout << "<unavailable>";
+                } else {
+                    ::std::cout << (static_cast<double>(misses) / (nbrepeats * pertxdiv));
+                }
+                ::std::cout << ::std::endl;
                 ::std::cout << "⎩ Average TX execution time: " << (perfdbl / pertxdiv) << " ns" << ::std::endl;
             } catch (::std::exception const& err) { // Special case: cannot unload library with running threads, so print error and quick-exit
                 ::std::cerr << "⎪ *** EXCEPTION ***" << ::std::endl;
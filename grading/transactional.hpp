@@ -29,6 +29,16 @@ extern "C" {
 #include <limits.h>
 }
 
+// Included at global scope first: 'tm.hpp' is included within a namespace below
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <time.h>
+
 // Internal headers
 namespace STM {
 #include <tm.hpp>
@@ -0,0 +1,218 @@
+/**
+ * @file   ebr.hpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Epoch-based reclamation, for the engines whose transactions may access
+ * shared memory that a concurrent transaction just freed (their reads are
+ * only validated afterwards).
+ *
+ * A domain holds a global epoch and one record per participating thread.
+ * A thread announces the global epoch in its record when it begins a
+ * transaction ('ebr_enter'), and clears it when the transaction ends or
+ * aborts ('ebr_leave'). Memory retired while the global epoch is 'e' is
+ * released once the global epoch reaches 'e + 2': the epoch only moves from
+ * 'e' to 'e + 1' when every thread in a transaction announced 'e', so every
+ * transaction that could have reached the retired memory is over by then.
+ *
+ * Each record keeps the memory its thread retired in a limbo list, in epoch
+ * order. The list is scanned every 'ebr_limbo_batch' retirements, and never
+ * grows past 'ebr_limbo_max' entries: a retiring thread waits for the
+ * running transactions to move on instead (it must not be in a transaction
+ * itself then).
+**/
+
+#ifndef EBR_HPP
+#define EBR_HPP
+
+// External headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <vector>
+
+static const size_t ebr_limbo_batch = 64;   // Number of retirements between two scans of a limbo list
+static const size_t ebr_limbo_max   = 1024; // Maximal length of a limbo list
+
+/**
+ * @brief Retired memory, released by calling 'release' on 'addr'.
+ */
+struct ebr_entry {
+    void* addr;
+    void (*release)(void*);
+    uint64_t epoch; // Global epoch at retirement
+};
+
+/**
+ * @brief Participating thread.
+ */
+struct ebr_record {
+    alignas(64) std::atomic<uint64_t> local; // Announced epoch shifted left by one with the low bit set while in a transaction, 0 otherwise
+    struct ebr_record* next;                 // Next record of the domain
+    std::vector<struct ebr_entry> limbo;     // Retired memory, in epoch order (private to the owner thread, 'ebr_limbo_max' reserved)
+    size_t scanned;                          // Length of 'limbo' at its last scan
+    std::thread::id owner;                   // Thread the record belongs to
+};
+
+/**
+ * @brief Reclamation domain, one per shared memory region.
+ */
+struct ebr_domain {
+    alignas(64) std::atomic<uint64_t> epoch;  // Global epoch
+    std::atomic<struct ebr_record*> records;  // Records of the participating threads (only ever pushed to)
+    uint64_t id;                              // Unique identifier, to tell apart domains allocated at the same address
+};
+
+/**
+ * @brief Record of the calling thread in the domain it used last.
+ */
+struct ebr_cache {
+    uint64_t id;                // Identifier of the domain, 0 for none
+    struct ebr_record* record;  // Record of the calling thread in that domain
+};
+
+static thread_local struct ebr_cache ebr_local = {0, NULL};
+
+// -------------------------------------------------------------------------- //
+
+/** Initialize a reclamation domain.
+ * @param domain Domain to initialize
+**/
+static void ebr_init(struct ebr_domain* domain) {
+    static std::atomic<uint64_t> ids{0};
+    domain->epoch.store(0, std::memory_order_relaxed);
+    domain->records.store(NULL, std::memory_order_relaxed);
+    domain->id = ids.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+/** Release all the memory retired in a domain, and the domain's records, with no thread in a transaction.
+ * @param domain Domain to clean up
+**/
+static void ebr_destroy(struct ebr_domain* domain) {
+    struct ebr_record* record = domain->records.load(std::memory_order_acquire);
+    while (record) {
+        struct ebr_record* next = record->next;
+        for (auto& entry: record->limbo)
+            entry.release(entry.addr);
+        delete record;
+        record = next;
+    }
+    domain->records.store(NULL, std::memory_order_relaxed);
+}
+
+/** Get the record of the calling thread in a domain, registering the thread on first use.
+ * @param domain Domain to participate in
+ * @return Record of the thread, 'NULL' on failure
+**/
+static inline struct ebr_record* ebr_record_of(struct ebr_domain* domain) {
+    if (likely(ebr_local.id == domain->id))
+        return ebr_local.record;
+    // A thread coming back to a domain finds its record in the list (the
+    // records only change hands when a thread id is reused after its thread ended)
+    std::thread::id self = std::this_thread::get_id();
+    for (struct ebr_record* record = domain->records.load(std::memory_order_acquire); record; record = record->next) {
+        if (record->owner == self) {
+            ebr_local = ebr_cache{domain->id, record};
+            return record;
+        }
+    }
+    struct ebr_record* record = new (std::nothrow) struct ebr_record;
+    if (unlikely(!record))
+        return NULL;
+    record->local.store(0, std::memory_order_relaxed);
+    record->scanned = 0;
+    record->owner   = self;
+    try {
+        record->limbo.reserve(ebr_limbo_max);
+    } catch (const std::bad_alloc&) {
+        delete record;
+        return NULL;
+    }
+    struct ebr_record* head = domain->records.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!domain->records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+    ebr_local = ebr_cache{domain->id, record};
+    return record;
+}
+
+/** Announce that the calling thread enters a transaction.
+ * @param domain Domain of the transaction
+ * @param record Record of the calling thread
+**/
+static inline void ebr_enter(struct ebr_domain* domain, struct ebr_record* record) {
+    uint64_t epoch = domain->epoch.load(std::memory_order_relaxed);
+    record->local.store((epoch << 1) | 1, std::memory_order_relaxed);
+    // The announcement must be visible before the transaction's first access
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/** Announce that the calling thread left its transaction (committed or aborted).
+ * @param record Record of the calling thread
+**/
+static inline void ebr_leave(struct ebr_record* record) {
+    record->local.store(0, std::memory_order_release);
+}
+
+/** Try to advance the global epoch, which succeeds when every thread in a transaction announced it.
+ * @param domain Domain to advance
+ * @return Global epoch after the attempt
+**/
+static uint64_t ebr_advance(struct ebr_domain* domain) {
+    uint64_t epoch = domain->epoch.load(std::memory_order_seq_cst);
+    uint64_t announce = (epoch << 1) | 1;
+    for (struct ebr_record* record = domain->records.load(std::memory_order_acquire); record; record = record->next) {
+        uint64_t local = record->local.load(std::memory_order_seq_cst);
+        if ((local & 1) && local != announce)
+            return epoch;
+    }
+    if (domain->epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst))
+        return epoch + 1;
+    return epoch; // Advanced concurrently
+}
+
+/** Release the memory retired by the calling thread that no transaction can access anymore.
+ * @param domain Domain of the memory
+ * @param record Record of the calling thread
+**/
+static void ebr_reclaim(struct ebr_domain* domain, struct ebr_record* record) {
+    uint64_t epoch = ebr_advance(domain);
+    auto& limbo = record->limbo;
+    size_t count = 0;
+    while (count < limbo.size() && limbo[count].epoch + 2 <= epoch) {
+        limbo[count].release(limbo[count].addr);
+        ++count;
+    }
+    limbo.erase(limbo.begin(), limbo.begin() + count);
+    record->scanned = limbo.size();
+}
+
+/** Retire memory that the calling thread unlinked, to release once no transaction can access it.
+ * @param domain  Domain of the memory
+ * @param record  Record of the calling thread, not in a transaction
+ * @param addr    Memory to retire
+ * @param release Function releasing the memory
+**/
+static void ebr_retire(struct ebr_domain* domain, struct ebr_record* record, void* addr, void (*release)(void*)) {
+    auto& limbo = record->limbo;
+    // Full limbo list: the running transactions end eventually
+    while (unlikely(limbo.size() >= ebr_limbo_max)) {
+        ebr_reclaim(domain, record);
+        if (limbo.size() >= ebr_limbo_max)
+            std::this_thread::yield();
+    }
+    // The epoch must be read after the memory was unlinked, not earlier
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    limbo.push_back(ebr_entry{addr, release, domain->epoch.load(std::memory_order_relaxed)}); // Within the reserved capacity
+    if (limbo.size() - record->scanned >= ebr_limbo_batch)
+        ebr_reclaim(domain, record);
+}
+
+#endif /* EBR_HPP */
@@ -0,0 +1,179 @@
+/**
+ * @file   validate.hpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Validation kernels of the timestamp-based engines, checking a run of
+ * logged version words against the snapshot of a transaction. A kernel
+ * returns the index of the first word that needs a closer look (the caller
+ * then checks it on its own, and resumes the kernel past it), so that the
+ * common case, a run that is still valid, stays in the kernel.
+ *
+ * The words are read 4 at a time with AVX2 (and the timestamps the words
+ * point to gathered), or one at a time on processors without it; the choice
+ * is made when the library is loaded. Versions, limits and masks must fit in
+ * 63 bits, as AVX2 only compares signed 64-bit lanes. The words are read
+ * with relaxed semantics, and a kernel ends with an acquire fence.
+**/
+
+#ifndef VALIDATE_HPP
+#define VALIDATE_HPP
+
+// External headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "the version words are loaded as plain 64-bit integers");
+
+/** Find the first word of a run with a bit of 'flags' set, or greater than 'limit'.
+ * @param words  First word of the run
+ * @param count  Number of words in the run
+ * @param stride Distance between two words of the run (in words)
+ * @param flags  Bits flagging a word (e.g. a lock bit)
+ * @param limit  Greatest word accepted
+ * @return Index of the first such word, 'count' if none
+**/
+using validate_fn = size_t (*)(std::atomic<uint64_t> const* words, size_t count, size_t stride, uint64_t flags, uint64_t limit);
+
+/** Find the first word of a run with a bit of 'flags' set, or pointing (once 'strip' is cleared) to a version whose timestamp, 'offset' bytes in, is greater than 'limit'.
+ * Words that are null once stripped point to no version and are accepted.
+ * @param words  First word of the run
+ * @param count  Number of words in the run
+ * @param stride Distance between two words of the run (in words)
+ * @param flags  Bits flagging a word (e.g. a lock bit)
+ * @param strip  Bits to clear from a word to get its pointer
+ * @param offset Offset of the timestamp in a version (in bytes)
+ * @param limit  Greatest timestamp accepted
+ * @return Index of the first such word, 'count' if none
+**/
+using validate_indirect_fn = size_t (*)(std::atomic<uint64_t> const* words, size_t count, size_t stride, uint64_t flags, uint64_t strip, size_t offset, uint64_t limit);
+
+// -------------------------------------------------------------------------- //
+
+/** Check the words one at a time (see 'validate_fn').
+**/
+static size_t validate_scalar(std::atomic<uint64_t> const* words, size_t count, size_t stride, uint64_t flags, uint64_t limit) {
+    size_t i = 0;
+    for (; i < count; ++i) {
+        uint64_t word = words[i * stride].load(std::memory_order_relaxed);
+        if ((word & flags) || word > limit)
+            break;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return i;
+}
+
+/** Check the words one at a time (see 'validate_indirect_fn').
+**/
+static size_t validate_indirect_scalar(std::atomic<uint64_t> const* words, size_t count, size_t stride, uint64_t flags, uint64_t strip, size_t offset, uint64_t limit) {
+    size_t i = 0;
+    for (; i < count; ++i) {
+        uint64_t word = words[i * stride].load(std::memory_order_acquire);
+        if (word & flags)
+            break;
+        uint64_t pointer = word & ~strip;
+        if (pointer && *(uint64_t const*) (pointer + offset) > limit)
+            break;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return i;
+}
+
+#if defined(__x86_64__)
+
+// Aligned 8-byte lanes of a vector load or gather are each read atomically on x86-64
+
+/** Load 4 words of a run, with AVX2.
+ * @param base   First word to load
+ * @param stride Distance between two words (in words)
+ * @return Words, the first one in the lowest lane
+**/
+__attribute__((target("avx2"))) static inline __m256i validate_load(long long const* base, size_t stride) {
+    if (stride == 1)
+        return _mm256_loadu_si256((__m256i const*) base);
+    // Separate loads beat a gather, which is slow on several processors
+    return _mm256_set_epi64x(base[3 * stride], base[2 * stride], base[stride], base[0]);
+}
+
+/** Check the words 4 at a time, with AVX2 (see 'validate_fn').
+**/
+__attribute__((target("avx2"))) static size_t validate_avx2(std::atomic<uint64_t> const* words, size_t count, size_t stride, uint64_t flags, uint64_t limit) {
+    __m256i f = _mm256_set1_epi64x(flags);
+    __m256i l = _mm256_set1_epi64x(limit);
+    __m256i zero = _mm256_setzero_si256();
+    long long const* base = (long long const*) words;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, base += 4 * stride) {
+        __m256i w = validate_load(base, stride);
+        __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi64(w, l), _mm256_andnot_si256(_mm256_cmpeq_epi64(_mm256_and_si256(w, f), zero), _mm256_set1_epi64x(-1)));
+        int bits = _mm256_movemask_pd(_mm256_castsi256_pd(bad));
+        if (bits) {
+            _mm256_zeroupper();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return i + __builtin_ctz(bits);
+        }
+    }
+    // Avoid the penalty of mixing in legacy SSE code with dirty upper halves
+    _mm256_zeroupper();
+    return i + validate_scalar(words + i * stride, count - i, stride, flags, limit);
+}
+
+/** Check the words 4 at a time, with AVX2, gathering the timestamps of their versions (see 'validate_indirect_fn').
+**/
+__attribute__((target("avx2"))) static size_t validate_indirect_avx2(std::atomic<uint64_t> const* words, size_t count, size_t stride, uint64_t flags, uint64_t strip, size_t offset, uint64_t limit) {
+    __m256i f = _mm256_set1_epi64x(flags);
+    __m256i s = _mm256_set1_epi64x(~strip);
+    __m256i l = _mm256_set1_epi64x(limit);
+    __m256i zero = _mm256_setzero_si256();
+    long long const* base = (long long const*) words;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, base += 4 * stride) {
+        __m256i w = validate_load(base, stride);
+        // The loads of the timestamps must not pass the loads of the pointers
+        std::atomic_thread_fence(std::memory_order_acquire);
+        __m256i pointer = _mm256_and_si256(w, s);
+        __m256i some = _mm256_andnot_si256(_mm256_cmpeq_epi64(pointer, zero), _mm256_set1_epi64x(-1));
+        // Only the lanes with a version are gathered, the others stay 0
+        __m256i ts = _mm256_mask_i64gather_epi64(zero, (long long const*) offset, pointer, some, 1);
+        __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi64(ts, l), _mm256_andnot_si256(_mm256_cmpeq_epi64(_mm256_and_si256(w, f), zero), _mm256_set1_epi64x(-1)));
+        int bits = _mm256_movemask_pd(_mm256_castsi256_pd(bad));
+        if (bits) {
+            _mm256_zeroupper();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return i + __builtin_ctz(bits);
+        }
+    }
+    _mm256_zeroupper();
+    return i + validate_indirect_scalar(words + i * stride, count - i, stride, flags, strip, offset, limit);
+}
+
+/** Tell whether the processor supports AVX2.
+ * @return Whether AVX2 is supported
+**/
+static inline bool validate_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// Kernels chosen when the library is loaded
+static validate_fn const validate_words = validate_has_avx2() ? validate_avx2 : validate_scalar;
+static validate_indirect_fn const validate_indirect = validate_has_avx2() ? validate_indirect_avx2 : validate_indirect_scalar;
+
+#else
+
+static validate_fn const validate_words = validate_scalar;
+static validate_indirect_fn const validate_indirect = validate_indirect_scalar;
+
+#endif
+
+#endif /* VALIDATE_HPP */
@@ -0,0 +1,208 @@
+/**
+ * @file   wset.hpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Index of a write set, from the address of a written word (or cell) to the
+ * position of its entry in the redo log, for the engines that buffer their
+ * writes and look them up on every read.
+ *
+ * The first 'wset_inline' keys sit in an inline array, in insertion order,
+ * so the position of a key is its index there; a lookup compares the key
+ * with all of them, 2 at a time with SSE2 (always there on x86-64, so the
+ * compare stays inline; calling an AVX2 kernel chosen at load time, as for
+ * the validation kernels, costs more than it saves on 16 keys). Past
+ * 'wset_inline' entries, the keys move to an open-addressing table with
+ * linear probing, kept at most half full. In both cases, a 64-bit bloom
+ * filter of the keys answers most lookups of unwritten words with a single
+ * test. Clearing the index keeps the table, so a warmed-up index allocates
+ * nothing. Keys must not be 0 (the empty slots).
+**/
+
+#ifndef WSET_HPP
+#define WSET_HPP
+
+// External headers
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+static const size_t wset_inline    = 16;         // Number of entries kept in the inline array
+static const size_t wset_min_slots = 64;         // Initial number of slots of the table (a power of 2)
+static const size_t wset_none      = ~(size_t) 0; // Position of a key not in the index
+
+/**
+ * @brief Slot of the table.
+ */
+struct wset_slot {
+    uintptr_t key; // Key, 0 if the slot is empty
+    size_t value;  // Position of the entry
+};
+
+/**
+ * @brief Write set index.
+ */
+struct wset {
+    alignas(16) uintptr_t keys[wset_inline] = {}; // First keys, in insertion order (stale past 'count')
+    size_t count = 0;                             // Number of entries
+    uint64_t bloom = 0;                           // Bloom filter of the keys, one bit each
+    int shift = 0;                                // 64 minus the binary logarithm of the number of slots
+    std::vector<struct wset_slot> table;          // Table, in use once 'count' exceeds 'wset_inline'
+};
+
+// -------------------------------------------------------------------------- //
+
+/** Hash a key (Fibonacci hashing: the high bits are the well mixed ones).
+ * @param key Key to hash
+ * @return Hash of the key
+**/
+static inline uint64_t wset_hash(uintptr_t key) {
+    return (uint64_t) key * UINT64_C(0x9e3779b97f4a7c15);
+}
+
+/** Get the bit of a key in the bloom filter.
+ * @param hash Hash of the key
+ * @return Bit of the key
+**/
+static inline uint64_t wset_bit(uint64_t hash) {
+    return (uint64_t) 1 << ((hash >> 32) & 63);
+}
+
+/** Find a key in the inline array.
+ * @param set Index, with at most 'wset_inline' entries
+ * @param key Key to find
+ * @return Position of the key, 'wset_none' if absent
+**/
+static inline size_t wset_find_inline(struct wset const* set, uintptr_t key) {
+    size_t count = set->count;
+    size_t i = 0;
+    // The lanes past 'count' hold stale keys, so a first match there is a miss
+#if defined(__x86_64__)
+    __m128i k = _mm_set1_epi64x(key);
+    for (; i < count; i += 2) {
+        // No 64-bit compare in SSE2: a lane matches if both its 32-bit halves do
+        __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((__m128i const*) (set->keys + i)), k);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        int bits = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (bits) {
+            i += __builtin_ctz(bits);
+            return i < count ? i : wset_none;
+        }
+    }
+#else
+    for (; i < count; ++i) {
+        if (set->keys[i] == key)
+            return i;
+    }
+#endif
+    return wset_none;
+}
+
+/** Put a key absent from the table in it.
+ * @param set   Index, whose table has room
+ * @param hash  Hash of the key
+ * @param key   Key to put
+ * @param value Position of the entry
+**/
+static inline void wset_place(struct wset* set, uint64_t hash, uintptr_t key, size_t value) {
+    size_t mask = set->table.size() - 1;
+    size_t i = hash >> set->shift;
+    while (set->table[i].key != 0)
+        i = (i + 1) & mask;
+    set->table[i] = wset_slot{key, value};
+}
+
+/** Move the keys of the full inline array to the table, reusing the (empty) table of a previous use if any.
+ * @param set Index, with 'wset_inline' entries
+**/
+static void wset_spill(struct wset* set) {
+    if (set->table.empty())
+        set->table.assign(wset_min_slots, wset_slot{0, 0});
+    set->shift = 64 - __builtin_ctzl(set->table.size());
+    for (size_t i = 0; i < wset_inline; ++i)
+        wset_place(set, wset_hash(set->keys[i]), set->keys[i], i);
+}
+
+/** Double the number of slots of the table, putting back its entries.
+ * @param set Index, using its table
+**/
+static void wset_grow(struct wset* set) {
+    std::vector<struct wset_slot> old(2 * set->table.size(), wset_slot{0, 0});
+    old.swap(set->table);
+    set->shift = 64 - __builtin_ctzl(set->table.size());
+    for (auto& slot: old) {
+        if (slot.key != 0)
+            wset_place(set, wset_hash(slot.key), slot.key, slot.value);
+    }
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Find a key in the index.
+ * @param set Index
+ * @param key Key to find
+ * @return Position of the key, 'wset_none' if absent
+**/
+static inline size_t wset_find(struct wset const* set, uintptr_t key) {
+    uint64_t hash = wset_hash(key);
+    if (!(set->bloom & wset_bit(hash)))
+        return wset_none;
+    if (set->count <= wset_inline)
+        return wset_find_inline(set, key);
+    size_t mask = set->table.size() - 1;
+    for (size_t i = hash >> set->shift;; i = (i + 1) & mask) {
+        struct wset_slot const& slot = set->table[i];
+        if (slot.key == key)
+            return slot.value;
+        if (slot.key == 0)
+            return wset_none;
+    }
+}
+
+/** Find a key in the index, adding it if absent.
+ * @param set Index
+ * @param key Key to find, not 0
+ * @return Position of the key, the previous number of entries if just added
+**/
+static inline size_t wset_insert(struct wset* set, uintptr_t key) {
+    size_t value = wset_find(set, key);
+    if (value != wset_none)
+        return value;
+    value = set->count;
+    uint64_t hash = wset_hash(key);
+    set->bloom |= wset_bit(hash);
+    if (set->count < wset_inline) {
+        set->keys[set->count++] = key;
+        return value;
+    }
+    if (set->count == wset_inline) {
+        wset_spill(set);
+    } else if (2 * (set->count + 1) > set->table.size()) {
+        wset_grow(set);
+    }
+    wset_place(set, hash, key, value);
+    ++set->count;
+    return value;
+}
+
+/** Remove every entry from the index, keeping its table.
+ * @param set Index
+**/
+static inline void wset_clear(struct wset* set) {
+    if (set->count > wset_inline)
+        memset((void*) set->table.data(), 0, set->table.size() * sizeof(struct wset_slot));
+    set->count = 0;
+    set->bloom = 0;
+}
+
+#endif /* WSET_HPP */
@@ -0,0 +1,946 @@
+/**
+ * @file   tm.cpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * Multi-version transaction manager: a chain of committed versions per cell,
+ * stamped with commit timestamps. Read-only transactions read the versions of
+ * their snapshot, and never abort nor wait. Read-write transactions read the
+ * latest versions, buffer their writes, and commit TL2-style: commit-time
+ * locking, then validation of the read set against the latest versions.
+**/
+
+// Requested features
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define _POSIX_C_SOURCE   200809L
+
+// External headers
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Internal headers
+#include "tm.hpp"
+
+#include "macros.h"
+#include "ebr.hpp"
+#include "validate.hpp"
+#include "wset.hpp"
+
+#ifdef TM_ENGINE
+// Built into another library, behind its dispatch table (see 376166/dispatch.cpp)
+namespace TM_ENGINE {
+#endif
+
+/**
+ * @brief Cells.
+ *
+ * The shared memory is cut in cells of 'cell' bytes, a word or, for words
+ * smaller than a pointer, the pointer-sized group of words holding it. The
+ * shared memory itself only holds the head of the version chain of each cell
+ * (the newest version first, 'NULL' for the zero-filled version at timestamp
+ * 0), with flags in its low bits: the values live in the versions.
+ *
+ * A committing writer takes a timestamp from 'clock', installs its versions,
+ * then publishes its timestamp in 'published', in timestamp order. A
+ * read-only transaction snapshots 'published' at begin, so that every version
+ * up to its snapshot is installed already. A read-write transaction reads the
+ * latest versions instead, as in TL2: its read version is 'clock' at begin,
+ * and it aborts on a locked cell. On a cell newer than its read version, it
+ * extends its snapshot instead, as in LSA: if its read set is still valid,
+ * the read version moves to the current 'clock' and the read goes on.
+ *
+ * The chain of a cell is trimmed whenever a writer installs a version: the
+ * versions past the first one no snapshot is older than are freed (see
+ * 'oldest_snapshot'). A cell left with more than two versions (some snapshot
+ * pinned its history) is queued for the sweeps that run after the commits, so
+ * that each cell holds at most two versions once the old snapshots end. The
+ * number of versions and of snapshot extensions is reported by 'tm_destroy'
+ * if 'TM_STATS' is set (and not "0").
+ */
+static const uintptr_t cell_locked = 1; // Taken by a committing writer
+static const uintptr_t cell_queued = 2; // In the sweep queue
+static const uintptr_t cell_flags  = cell_locked | cell_queued;
+
+static const uint64_t snapshot_idle = UINT64_MAX; // Announced snapshot outside of transactions
+
+static const size_t publish_spins = 64; // Number of polls for the previous commit before yielding the processor
+
+/**
+ * @brief Committed value of a cell.
+ */
+struct version {
+    uint64_t ts;          // Commit timestamp
+    struct version* next; // Previous version of the cell
+    // uint8_t value[]    // Value of dynamic size ('cell' bytes)
+};
+
+/**
+ * @brief Allocated segment, in a list for 'tm_destroy'.
+ */
+struct segment_node {
+    struct segment_node* next;
+    struct region* region; // Region of the segment, for 'segment_release'
+    size_t size;           // Size of the segment (in bytes, a multiple of the cell size)
+    // uint8_t segment[] // segment of dynamic size
+};
+
+/**
+ * @brief Snapshot announced by a participating thread.
+ */
+struct snapshot_slot {
+    alignas(64) std::atomic<uint64_t> rv; // Snapshot of the running transaction, 'snapshot_idle' for none
+    struct snapshot_slot* next;           // Next slot of the region
+    std::thread::id owner;                // Thread the slot belongs to
+};
+
+/**
+ * @brief Simple Shared Memory Region (a.k.a Transactional Memory).
+ */
+struct region {
+    alignas(64) std::atomic<uint64_t> clock;     // Last commit timestamp taken
+    alignas(64) std::atomic<uint64_t> published; // Last commit timestamp whose versions, and those of all the earlier ones, are installed
+    alignas(64) std::atomic<struct snapshot_slot*> slots; // Slots of the participating threads (only ever pushed to)
+    std::atomic<size_t> versions;  // Number of versions allocated
+    std::atomic<size_t> peak;      // Highest value of 'versions'
+    std::atomic<size_t> trimmed;   // Number of versions freed by trimming
+    std::atomic<uint64_t> extensions; // Snapshot extensions of the ended read-write transactions
+    std::atomic<uint64_t> extended;   // Ended read-write transactions that extended their snapshot
+    std::atomic<uint64_t> most;       // Most snapshot extensions of one transaction
+    struct segment_node* first;    // Non-deallocable memory segment
+    void* start;                   // Start of the shared memory region (i.e., of the non-deallocable memory segment)
+    size_t size;                   // Size of the non-deallocable memory segment (in bytes)
+    size_t align;                  // Size of a word in the shared memory region (in bytes)
+    size_t cell;                   // Size of a cell (in bytes)
+    std::mutex allocs_lock;        // Protects 'allocs'
+    struct segment_node* allocs;   // Segments dynamically allocated via tm_alloc
+    struct ebr_domain ebr;         // Reclamation of the segments freed by committed transactions
+    std::mutex sweep_lock;         // Protects 'queued' and 'swept'
+    std::vector<std::atomic<uintptr_t>*> queued; // Cells with more than two versions
+    uint64_t swept;                // Oldest snapshot at the last sweep
+    bool stats;                    // Whether to print the number of versions and of extensions in 'tm_destroy'
+};
+
+/**
+ * @brief Buffered write of one cell.
+ */
+struct write_entry {
+    std::atomic<uintptr_t>* cell; // Written cell (in the shared region)
+    size_t offset;                // Offset of the buffered value in the transaction's data buffer
+    uint8_t mask;                 // Written words of the cell
+};
+
+/**
+ * @brief Run of consecutive cells read, so that a scan logs one entry.
+ */
+struct read_run {
+    std::atomic<uintptr_t>* first; // First cell of the run (in the shared region)
+    size_t count;                  // Number of cells in the run
+};
+
+/**
+ * @brief Record of the calling thread in the region it used last.
+ */
+struct slot_cache {
+    uint64_t id;                // Identifier of the region's reclamation domain, 0 for none
+    struct snapshot_slot* slot; // Slot of the calling thread in that region
+};
+
+/**
+ * @brief Transaction descriptor, one per thread.
+ */
+struct transaction {
+    bool is_ro;                                   // Whether the transaction is read-only
+    uint64_t rv;                                  // Snapshot ('published' at begin) if read-only, read version ('clock' at begin or at the last extension) otherwise
+    uint64_t extensions;                          // Number of snapshot extensions (read-write transactions)
+    std::vector<struct read_run> reads;           // Cells read (read-write transactions)
+    std::vector<struct write_entry> writes;       // Redo log
+    struct wset index;                            // Cell address to redo log entry
+    std::vector<uint8_t> data;                    // Buffered values of the redo log
+    std::vector<std::atomic<uintptr_t>*> locked;  // Cells locked at commit (sorted)
+    std::vector<struct version*> spare;           // Versions allocated ahead for the commits of the thread
+    std::vector<std::atomic<uintptr_t>*> queue;   // Cells to add to the sweep queue after the commit
+    std::vector<struct segment_node*> allocs;     // Segments allocated by the transaction, to free on abort
+    struct ebr_record* ebr;                       // Record of the thread in the region's reclamation domain
+    struct snapshot_slot* slot;                   // Slot of the thread in the region
+    std::vector<struct segment_node*> frees;      // Segments freed by the transaction, to retire on commit
+};
+
+static thread_local struct transaction tx_local;
+static thread_local struct slot_cache slot_local = {0, NULL};
+
+// -------------------------------------------------------------------------- //
+
+/** Hint the processor that we are spin-waiting.
+**/
+static inline void spin_pause() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/** Get the distance between a segment node and its segment, which keeps the segment aligned.
+ * @param region Shared memory region
+ * @return Distance (in bytes)
+**/
+static inline size_t segment_pad(struct region* region) {
+    return (sizeof(struct segment_node) + region->cell - 1) & ~(region->cell - 1);
+}
+
+/** Get the segment node heading the given segment.
+ * @param region  Shared memory region
+ * @param segment Start address of the segment
+ * @return Segment node
+**/
+static inline struct segment_node* node_of(struct region* region, void* segment) {
+    return (struct segment_node*) ((uintptr_t) segment - segment_pad(region));
+}
+
+/** Get the value of a version.
+ * @param version Version
+ * @return Value ('cell' bytes)
+**/
+static inline uint8_t* value_of(struct version* version) {
+    return (uint8_t*) (version + 1);
+}
+
+/** Get the version a head of chain points to.
+ * @param head Head of chain, with its flags
+ * @return Newest version, 'NULL' for the zero-filled one
+**/
+static inline struct version* version_of(uintptr_t head) {
+    return (struct version*) (head & ~cell_flags);
+}
+
+/** Get the cell holding the given word.
+ * @param region Shared memory region
+ * @param addr   Address of the word
+ * @return Cell
+**/
+static inline std::atomic<uintptr_t>* cell_of(struct region* region, void const* addr) {
+    return (std::atomic<uintptr_t>*) ((uintptr_t) addr & ~(region->cell - 1));
+}
+
+/** Get the mask of the given word in its cell.
+ * @param region Shared memory region
+ * @param addr   Address of the word
+ * @return Mask, with one bit per word of the cell
+**/
+static inline uint8_t word_bit(struct region* region, void const* addr) {
+    return (uint8_t) 1 << (((uintptr_t) addr & (region->cell - 1)) / region->align);
+}
+
+/** Copy a word out of a version.
+ * @param region  Shared memory region
+ * @param version Version of the cell of the word, 'NULL' for the zero-filled one
+ * @param addr    Address of the word
+ * @param target  Target address (in a private region)
+**/
+static inline void copy_word(struct region* region, struct version* version, void const* addr, void* target) {
+    if (version) {
+        memcpy(target, value_of(version) + ((uintptr_t) addr & (region->cell - 1)), region->align);
+    } else {
+        memset(target, 0, region->align);
+    }
+}
+
+/** Get the slot of the calling thread in a region, registering the thread on first use.
+ * @param region Shared memory region
+ * @return Slot of the thread, 'NULL' on failure
+**/
+static inline struct snapshot_slot* slot_of(struct region* region) {
+    if (likely(slot_local.id == region->ebr.id))
+        return slot_local.slot;
+    // Back to a region used before: reuse the slot registered then
+    std::thread::id self = std::this_thread::get_id();
+    for (struct snapshot_slot* slot = region->slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+        if (slot->owner == self) {
+            slot_local = slot_cache{region->ebr.id, slot};
+            return slot;
+        }
+    }
+    struct snapshot_slot* slot = new (std::nothrow) struct snapshot_slot;
+    if (unlikely(!slot))
+        return NULL;
+    slot->rv.store(snapshot_idle, std::memory_order_relaxed);
+    slot->owner = self;
+    struct snapshot_slot* head = region->slots.load(std::memory_order_relaxed);
+    do {
+        slot->next = head;
+    } while (!region->slots.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+    slot_local = slot_cache{region->ebr.id, slot};
+    return slot;
+}
+
+/** Get the oldest snapshot a running or future transaction can read at.
+ * @param region Shared memory region
+ * @return Oldest snapshot
+**/
+static uint64_t oldest_snapshot(struct region* region) {
+    // Loaded first: a transaction announcing a snapshot after the scan checks
+    // that 'published' did not move since, see 'tm_begin'
+    uint64_t oldest = region->published.load(std::memory_order_seq_cst);
+    for (struct snapshot_slot* slot = region->slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+        uint64_t rv = slot->rv.load(std::memory_order_seq_cst);
+        if (rv < oldest)
+            oldest = rv;
+    }
+    return oldest;
+}
+
+/** Count a change of the number of versions.
+ * @param region Shared memory region
+ * @param added  Number of versions allocated
+ * @param freed  Number of versions freed
+**/
+static void count_versions(struct region* region, size_t added, size_t freed) {
+    if (added <= freed) {
+        region->versions.fetch_sub(freed - added, std::memory_order_relaxed);
+        return;
+    }
+    size_t count = region->versions.fetch_add(added - freed, std::memory_order_relaxed) + added - freed;
+    size_t peak = region->peak.load(std::memory_order_relaxed);
+    while (peak < count && !region->peak.compare_exchange_weak(peak, count, std::memory_order_relaxed));
+}
+
+/** Free a chain of versions.
+ * @param version First version to free
+ * @return Number of versions freed
+**/
+static size_t free_chain(struct version* version) {
+    size_t count = 0;
+    while (version) {
+        struct version* next = version->next;
+        free(version);
+        version = next;
+        ++count;
+    }
+    return count;
+}
+
+/** Trim a chain past its first version no snapshot is older than, with the cell locked.
+ * @param version Newest version of the chain
+ * @param oldest  Oldest snapshot
+ * @param freed   Number of versions freed (incremented)
+ * @return Number of versions left in the chain
+**/
+static size_t trim(struct version* version, uint64_t oldest, size_t* freed) {
+    // The readers stop at the first version not newer than their snapshot,
+    // so none of them reaches past that version
+    size_t count = 0;
+    while (version) {
+        ++count;
+        if (version->ts <= oldest) {
+            *freed += free_chain(version->next);
+            version->next = NULL;
+            break;
+        }
+        version = version->next;
+    }
+    return count;
+}
+
+/** Release a segment and the versions of its cells, with no transaction left to access it.
+ * @param arg Segment node
+**/
+static void segment_release(void* arg) {
+    struct segment_node* sn = (struct segment_node*) arg;
+    struct region* region = sn->region;
+    uintptr_t segment = (uintptr_t) sn + segment_pad(region);
+    size_t freed = 0;
+    for (size_t offset = 0; offset < sn->size; offset += region->cell)
+        freed += free_chain(version_of(((std::atomic<uintptr_t>*) (segment + offset))->load(std::memory_order_relaxed)));
+    count_versions(region, 0, freed);
+    free(sn);
+}
+
+/** Trim the chains of the queued cells, if the oldest snapshot moved since the last sweep.
+ * @param region Shared memory region
+**/
+static void sweep(struct region* region) {
+    std::unique_lock<std::mutex> guard{region->sweep_lock, std::try_to_lock};
+    if (!guard.owns_lock() || region->queued.empty())
+        return;
+    uint64_t oldest = oldest_snapshot(region);
+    if (oldest == region->swept)
+        return;
+    region->swept = oldest;
+    size_t kept = 0;
+    size_t freed = 0;
+    for (auto cell: region->queued) {
+        uintptr_t head = cell->load(std::memory_order_relaxed);
+        if ((head & cell_locked) || !cell->compare_exchange_strong(head, head | cell_locked, std::memory_order_acquire)) {
+            region->queued[kept++] = cell; // Committing writer, next sweep
+            continue;
+        }
+        if (trim(version_of(head), oldest, &freed) > 2) {
+            region->queued[kept++] = cell;
+            cell->store(head, std::memory_order_release);
+        } else {
+            cell->store(head & ~cell_queued, std::memory_order_release);
+        }
+    }
+    region->queued.resize(kept);
+    guard.unlock();
+    region->trimmed.fetch_add(freed, std::memory_order_relaxed);
+    count_versions(region, 0, freed);
+}
+
+/** Leave the running transaction: withdraw its snapshot, and account for its extensions.
+ * @param region Shared memory region
+ * @param tx     Transaction to leave
+**/
+static void tx_leave(struct region* region, struct transaction* tx) {
+    tx->slot->rv.store(snapshot_idle, std::memory_order_release);
+    ebr_leave(tx->ebr);
+    if (unlikely(tx->extensions != 0) && region->stats) {
+        region->extensions.fetch_add(tx->extensions, std::memory_order_relaxed);
+        region->extended.fetch_add(1, std::memory_order_relaxed);
+        uint64_t most = region->most.load(std::memory_order_relaxed);
+        while (most < tx->extensions && !region->most.compare_exchange_weak(most, tx->extensions, std::memory_order_relaxed));
+    }
+}
+
+/** Abort the given transaction: drop its logs and release its allocations.
+ * @param region Shared memory region
+ * @param tx     Transaction to abort
+**/
+static void tx_abort(struct region* region, struct transaction* tx) {
+    tx_leave(region, tx);
+    if (!tx->allocs.empty()) {
+        std::unique_lock<std::mutex> guard{region->allocs_lock};
+        for (auto sn: tx->allocs) {
+            struct segment_node** link = &(region->allocs);
+            while (*link != sn)
+                link = &((*link)->next);
+            *link = sn->next;
+            free(sn); // Never written by a committed transaction, so without versions
+        }
+    }
+}
+
+/** Unlink the segments freed by the given transaction from the region's list, if they are all still in it.
+ * @param region Shared memory region
+ * @param tx     Transaction to commit
+ * @return Whether they were all unlinked (otherwise none is)
+**/
+static bool unlink_frees(struct region* region, struct transaction* tx) {
+    std::unique_lock<std::mutex> guard{region->allocs_lock};
+    for (size_t i = 0; i < tx->frees.size(); ++i) {
+        struct segment_node* sn = tx->frees[i];
+        struct segment_node** link = &(region->allocs);
+        while (*link && *link != sn)
+            link = &((*link)->next);
+        if (!*link) { // Freed by a transaction that committed first: put back the ones unlinked
+            while (i-- > 0) {
+                tx->frees[i]->next = region->allocs;
+                region->allocs = tx->frees[i];
+            }
+            return false;
+        }
+        *link = sn->next;
+    }
+    return true;
+}
+
+/** Release the locks taken at commit, leaving the cells unchanged.
+ * @param tx Transaction holding the locks
+**/
+static void release_locks(struct transaction* tx) {
+    for (auto cell: tx->locked)
+        cell->fetch_and(~cell_locked, std::memory_order_release);
+    tx->locked.clear();
+}
+
+/** Check that no read cell got a version newer than the read version, nor is locked by another transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to validate, holding its commit locks
+ * @return Whether the read set is still valid
+**/
+static bool validate(struct region* region, struct transaction* tx) {
+    size_t stride = region->cell / sizeof(uint64_t);
+    for (auto& run: tx->reads) {
+        // The kernel stops at the locked cells, which may be ours
+        auto words = (std::atomic<uint64_t> const*) run.first;
+        for (size_t i = 0; (i += validate_indirect(words + i * stride, run.count - i, stride, cell_locked, cell_flags, offsetof(struct version, ts), tx->rv)) < run.count; ++i) {
+            std::atomic<uintptr_t>* cell = (std::atomic<uintptr_t>*) ((uintptr_t) run.first + i * region->cell);
+            uintptr_t head = cell->load(std::memory_order_acquire);
+            struct version* latest = version_of(head);
+            if (latest && latest->ts > tx->rv)
+                return false;
+            if ((head & cell_locked) && !std::binary_search(tx->locked.begin(), tx->locked.end(), cell))
+                return false;
+        }
+    }
+    return true;
+}
+
+/** Extend the read version of the given read-write transaction to the current clock, if its read set is still valid at its read version.
+ * @param region Shared memory region
+ * @param tx     Transaction to extend, holding no commit lock
+ * @return Whether the read version was extended
+**/
+static bool extend(struct region* region, struct transaction* tx) {
+    // Writers lock their cells before taking their timestamp (see 'commit')
+    uint64_t now = region->clock.load(std::memory_order_acquire);
+    if (!validate(region, tx))
+        return false;
+    tx->rv = now;
+    ++tx->extensions;
+    return true;
+}
+
+/** Add a read cell to the read set, extending the last run if it follows it.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param cell   Cell read
+**/
+static inline void log_read(struct region* region, struct transaction* tx, std::atomic<uintptr_t>* cell) {
+    if (!tx->reads.empty()) {
+        struct read_run& run = tx->reads.back();
+        uintptr_t last = (uintptr_t) run.first + (run.count - 1) * region->cell;
+        if ((uintptr_t) cell == last + region->cell) {
+            ++run.count;
+            return;
+        }
+        if ((uintptr_t) cell == last) // Other word of the cell read last
+            return;
+    }
+    tx->reads.push_back(read_run{cell, 1});
+}
+
+/** Read a word in the given transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param source Source word (in the shared region)
+ * @param target Target address (in a private region)
+ * @return Whether the transaction can continue
+**/
+static bool read_word(struct region* region, struct transaction* tx, void const* source, void* target) {
+    std::atomic<uintptr_t>* cell = cell_of(region, source);
+    if (tx->is_ro) { // Version of the snapshot, always installed already
+        struct version* version = version_of(cell->load(std::memory_order_acquire));
+        while (version && version->ts > tx->rv)
+            version = version->next;
+        copy_word(region, version, source, target);
+        return true;
+    }
+    if (!tx->writes.empty()) {
+        size_t pos = wset_find(&(tx->index), (uintptr_t) cell);
+        if (pos != wset_none) {
+            struct write_entry& entry = tx->writes[pos];
+            if (entry.mask & word_bit(region, source)) { // Read our own write
+                memcpy(target, tx->data.data() + entry.offset + ((uintptr_t) source & (region->cell - 1)), region->align);
+                return true;
+            }
+        }
+    }
+    uintptr_t head = cell->load(std::memory_order_acquire);
+    struct version* latest = version_of(head);
+    while (unlikely(latest && latest->ts > tx->rv) && !(head & cell_locked)) { // Overwritten since the read version
+        if (!extend(region, tx))
+            return false;
+        head = cell->load(std::memory_order_acquire);
+        latest = version_of(head);
+    }
+    if (head & cell_locked)
+        return false;
+    log_read(region, tx, cell);
+    copy_word(region, latest, source, target);
+    return true;
+}
+
+/** Buffer the write of a word in the given transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param source Source address (in a private region)
+ * @param target Target word (in the shared region)
+**/
+static void write_word(struct region* region, struct transaction* tx, void const* source, void* target) {
+    std::atomic<uintptr_t>* cell = cell_of(region, target);
+    size_t pos = wset_insert(&(tx->index), (uintptr_t) cell);
+    if (pos == tx->writes.size()) {
+        tx->writes.push_back(write_entry{cell, tx->data.size(), 0});
+        tx->data.resize(tx->data.size() + region->cell);
+    }
+    struct write_entry& entry = tx->writes[pos];
+    memcpy(tx->data.data() + entry.offset + ((uintptr_t) target & (region->cell - 1)), source, region->align);
+    entry.mask |= word_bit(region, target);
+}
+
+/** Install the version of a written cell, locked by the committing transaction, and unlock it.
+ * @param region  Shared memory region
+ * @param tx      Committing transaction
+ * @param entry   Redo log entry of the cell
+ * @param version Version to install, stamped with the commit timestamp
+ * @param oldest  Oldest snapshot
+ * @param freed   Number of versions freed by trimming (incremented)
+**/
+static void install(struct region* region, struct transaction* tx, struct write_entry& entry, struct version* version, uint64_t oldest, size_t* freed) {
+    size_t cell = region->cell;
+    uintptr_t head = entry.cell->load(std::memory_order_relaxed);
+    struct version* latest = version_of(head);
+    uint8_t const* source = tx->data.data() + entry.offset;
+    if (entry.mask == (uint8_t) ((1u << (cell / region->align)) - 1)) {
+        memcpy(value_of(version), source, cell);
+    } else { // Partly written, the other words come from the latest version
+        if (latest) {
+            memcpy(value_of(version), value_of(latest), cell);
+        } else {
+            memset(value_of(version), 0, cell);
+        }
+        for (size_t offset = 0; offset < cell; offset += region->align) {
+            if (entry.mask & ((uint8_t) 1 << (offset / region->align)))
+                memcpy(value_of(version) + offset, source + offset, region->align);
+        }
+    }
+    version->next = latest;
+    uintptr_t next = (uintptr_t) version | (head & cell_queued);
+    if (trim(version, oldest, freed) > 2 && !(head & cell_queued)) {
+        next |= cell_queued;
+        tx->queue.push_back(entry.cell);
+    }
+    entry.cell->store(next, std::memory_order_release);
+}
+
+/** Commit the given read-write transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to commit
+ * @return Whether the transaction committed
+**/
+static bool commit(struct region* region, struct transaction* tx) {
+    // Allocate the versions before taking any lock
+    while (tx->spare.size() < tx->writes.size()) {
+        struct version* version = (struct version*) malloc(sizeof(struct version) + region->cell);
+        if (unlikely(!version))
+            return false;
+        tx->spare.push_back(version);
+    }
+    // Lock the written cells, in address order
+    for (auto& entry: tx->writes)
+        tx->locked.push_back(entry.cell);
+    std::sort(tx->locked.begin(), tx->locked.end());
+    for (size_t i = 0; i < tx->locked.size(); ++i) {
+        std::atomic<uintptr_t>* cell = tx->locked[i];
+        uintptr_t head = cell->load(std::memory_order_relaxed);
+        if ((head & cell_locked) || !cell->compare_exchange_strong(head, head | cell_locked, std::memory_order_acquire)) {
+            tx->locked.resize(i);
+            release_locks(tx);
+            return false;
+        }
+    }
+    // Take the commit timestamp, and validate the read set unless no one took one since the read version
+    uint64_t wv = region->clock.fetch_add(1, std::memory_order_acq_rel) + 1;
+    bool valid = wv == tx->rv + 1 || validate(region, tx);
+    // Of two transactions freeing the same segment (each having read it still
+    // allocated), the one unlinking it second aborts
+    valid = valid && (tx->frees.empty() || unlink_frees(region, tx));
+    if (valid) {
+        uint64_t oldest = oldest_snapshot(region);
+        size_t freed = 0;
+        for (auto& entry: tx->writes) {
+            struct version* version = tx->spare.back();
+            tx->spare.pop_back();
+            version->ts = wv;
+            install(region, tx, entry, version, oldest, &freed);
+        }
+        tx->locked.clear();
+        if (freed > 0)
+            region->trimmed.fetch_add(freed, std::memory_order_relaxed);
+        count_versions(region, tx->writes.size(), freed);
+        if (!tx->queue.empty()) {
+            std::unique_lock<std::mutex> guard{region->sweep_lock};
+            region->queued.insert(region->queued.end(), tx->queue.begin(), tx->queue.end());
+            tx->queue.clear();
+        }
+    } else {
+        release_locks(tx);
+    }
+    // Publish the timestamp (even unused) once the earlier commits installed their versions
+    for (size_t poll = 0; region->published.load(std::memory_order_acquire) != wv - 1; ++poll) {
+        if (poll < publish_spins) {
+            spin_pause();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    region->published.store(wv, std::memory_order_release);
+    return valid;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
+ * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
+ * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
+ * @return Opaque shared memory region handle, 'invalid_shared' on failure
+**/
+shared_t tm_create(size_t size, size_t align) noexcept {
+    struct region* region = new (std::nothrow) struct region;
+    if (unlikely(!region)) {
+        return invalid_shared;
+    }
+    region->align = align;
+    region->cell  = align < sizeof(uintptr_t) ? sizeof(uintptr_t) : align;
+    size_t pad  = segment_pad(region);
+    size_t span = (size + region->cell - 1) & ~(region->cell - 1);
+    struct segment_node* sn;
+    if (posix_memalign((void**) &sn, region->cell, pad + span) != 0) {
+        delete region;
+        return invalid_shared;
+    }
+    // Zero-filled cells have no version: they read as zeros
+    memset((void*) ((uintptr_t) sn + pad), 0, span);
+    sn->next   = NULL;
+    sn->region = region;
+    sn->size   = span;
+    region->clock.store(0, std::memory_order_relaxed);
+    region->published.store(0, std::memory_order_relaxed);
+    region->slots.store(NULL, std::memory_order_relaxed);
+    region->versions.store(0, std::memory_order_relaxed);
+    region->peak.store(0, std::memory_order_relaxed);
+    region->trimmed.store(0, std::memory_order_relaxed);
+    region->extensions.store(0, std::memory_order_relaxed);
+    region->extended.store(0, std::memory_order_relaxed);
+    region->most.store(0, std::memory_order_relaxed);
+    region->first  = sn;
+    region->start  = (void*) ((uintptr_t) sn + pad);
+    region->size   = size;
+    region->allocs = NULL;
+    region->swept  = 0;
+    char const* env = getenv("TM_STATS");
+    region->stats  = env && env[0] != '\0' && strcmp(env, "0") != 0;
+    ebr_init(&(region->ebr));
+    return region;
+}
+
+/** Destroy (i.e. clean-up + free) a given shared memory region.
+ * @param shared Shared memory region to destroy, with no running transaction
+**/
+void tm_destroy(shared_t shared) noexcept {
+    struct region* region = (struct region*) shared;
+    if (region->stats) {
+        size_t bytes = sizeof(struct version) + region->cell;
+        size_t peak = region->peak.load(std::memory_order_relaxed);
+        size_t live = region->versions.load(std::memory_order_relaxed);
+        fprintf(stderr, "mvcc: %lu versions at most (%lu bytes), %lu at the end, %lu trimmed\n", (unsigned long) peak, (unsigned long) (peak * bytes), (unsigned long) live, (unsigned long) region->trimmed.load(std::memory_order_relaxed));
+        fprintf(stderr, "mvcc: %lu snapshot extensions, in %lu transactions, at most %lu in one\n", (unsigned long) region->extensions.load(std::memory_order_relaxed), (unsigned long) region->extended.load(std::memory_order_relaxed), (unsigned long) region->most.load(std::memory_order_relaxed));
+    }
+    ebr_destroy(&(region->ebr));
+    struct segment_node* list = region->allocs;
+    while (list) {
+        struct segment_node* tail = list->next;
+        segment_release(list);
+        list = tail;
+    }
+    segment_release(region->first);
+    struct snapshot_slot* slot = region->slots.load(std::memory_order_relaxed);
+    while (slot) {
+        struct snapshot_slot* next = slot->next;
+        delete slot;
+        slot = next;
+    }
+    delete region;
+}
+
+/** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
+ * @param shared Shared memory region to query
+ * @return Start address of the first allocated segment
+**/
+void* tm_start(shared_t shared) noexcept {
+    return ((struct region*) shared)->start;
+}
+
+/** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
+ * @param shared Shared memory region to query
+ * @return First allocated segment size
+**/
+size_t tm_size(shared_t shared) noexcept {
+    return ((struct region*) shared)->size;
+}
+
+/** [thread-safe] Return the alignment (in bytes) of the memory accesses on the given shared memory region.
+ * @param shared Shared memory region to query
+ * @return Alignment used globally
+**/
+size_t tm_align(shared_t shared) noexcept {
+    return ((struct region*) shared)->align;
+}
+
+/** [thread-safe] Begin a new transaction on the given shared memory region.
+ * @param shared Shared memory region to start a transaction on
+ * @param is_ro  Whether the transaction is read-only
+ * @return Opaque transaction ID, 'invalid_tx' on failure
+**/
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* tx = &tx_local;
+    tx->ebr = ebr_record_of(&(region->ebr));
+    if (unlikely(!tx->ebr))
+        return invalid_tx;
+    tx->slot = slot_of(region);
+    if (unlikely(!tx->slot))
+        return invalid_tx;
+    ebr_enter(&(region->ebr), tx->ebr);
+    // Announce the snapshot, retrying if 'published' moved meanwhile: the
+    // trimming then accounts for the snapshot (see 'oldest_snapshot')
+    uint64_t rv = region->published.load(std::memory_order_seq_cst);
+    while (true) {
+        tx->slot->rv.store(rv, std::memory_order_seq_cst);
+        uint64_t now = region->published.load(std::memory_order_seq_cst);
+        if (now == rv)
+            break;
+        rv = now;
+    }
+    tx->is_ro = is_ro;
+    tx->rv = is_ro ? rv : region->clock.load(std::memory_order_acquire);
+    tx->extensions = 0;
+    tx->reads.clear();
+    tx->writes.clear();
+    wset_clear(&(tx->index));
+    tx->data.clear();
+    tx->allocs.clear();
+    tx->frees.clear();
+    return (tx_t) tx;
+}
+
+/** [thread-safe] End the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to end
+ * @return Whether the whole transaction committed
+**/
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    if (t->is_ro || (t->writes.empty() && t->frees.empty())) {
+        // Every read was of a version up to the snapshot or read version: nothing to publish
+        tx_leave(region, t);
+        return true;
+    }
+    // The frees take a timestamp too, so that they come after the earlier
+    // commits queue the cells of the freed segments for the sweeps
+    if (!commit(region, t)) {
+        tx_abort(region, t);
+        return false;
+    }
+    tx_leave(region, t);
+    if (!t->frees.empty()) {
+        {
+            std::unique_lock<std::mutex> guard{region->sweep_lock};
+            auto& queued = region->queued;
+            for (auto sn: t->frees) {
+                uintptr_t segment = (uintptr_t) sn + segment_pad(region);
+                queued.erase(std::remove_if(queued.begin(), queued.end(), [&](std::atomic<uintptr_t>* cell) {
+                    return (uintptr_t) cell >= segment && (uintptr_t) cell < segment + sn->size;
+                }), queued.end());
+            }
+        }
+        // Older snapshots may still read a freed segment, so its memory is
+        // only released once the transactions running now all ended
+        for (auto sn: t->frees)
+            ebr_retire(&(region->ebr), t->ebr, sn, segment_release);
+    }
+    sweep(region);
+    return true;
+}
+
+/** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in the shared region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in a private region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    size_t align = region->align;
+    for (size_t offset = 0; offset < size; offset += align) {
+        if (unlikely(!read_word(region, t, (char const*) source + offset, (char*) target + offset))) {
+            tx_abort(region, t);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in a private region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in the shared region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    size_t align = region->align;
+    for (size_t offset = 0; offset < size; offset += align)
+        write_word(region, t, (char const*) source + offset, (char*) target + offset);
+    return true;
+}
+
+/** [thread-safe] Memory allocation in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param size   Allocation requested size (in bytes), must be a positive multiple of the alignment
+ * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
+ * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
+**/
+Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    // The alignment of the node fields must be satisfied as well
+    size_t pad  = segment_pad(region);
+    size_t span = (size + region->cell - 1) & ~(region->cell - 1);
+    struct segment_node* sn;
+    if (unlikely(posix_memalign((void**) &sn, region->cell, pad + span) != 0))
+        return Alloc::nomem;
+    void* segment = (void*) ((uintptr_t) sn + pad);
+    memset(segment, 0, span);
+    sn->region = region;
+    sn->size   = span;
+    try {
+        t->allocs.push_back(sn);
+    } catch (const std::bad_alloc&) {
+        free(sn);
+        return Alloc::nomem;
+    }
+    {
+        std::unique_lock<std::mutex> guard{region->allocs_lock};
+        sn->next = region->allocs;
+        region->allocs = sn;
+    }
+    *target = segment;
+    return Alloc::success;
+}
+
+/** [thread-safe] Memory freeing in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param target Address of the first byte of the previously allocated segment to deallocate
+ * @return Whether the whole transaction can continue
+**/
+bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
+    ((struct transaction*) tx)->frees.push_back(node_of((struct region*) shared, target));
+    return true;
+}
+
+#ifdef TM_ENGINE
+} // namespace TM_ENGINE
+#endif
@@ -0,0 +1,471 @@
+/**
+ * @file   tm.cpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * NOrec transaction manager: no per-word metadata, a single global sequence
+ * lock, a read set of (address, value) pairs revalidated by value whenever
+ * the sequence lock moves, and commits serialized under the sequence lock.
+**/
+
+// Requested features
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define _POSIX_C_SOURCE   200809L
+
+// External headers
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Internal headers
+#include "tm.hpp"
+
+#include "macros.h"
+#include "ebr.hpp"
+#include "wset.hpp"
+
+#ifdef TM_ENGINE
+// Built into another library, behind its dispatch table (see 376166/dispatch.cpp)
+namespace TM_ENGINE {
+#endif
+
+/**
+ * @brief Allocated segment, in a list for 'tm_destroy'.
+ */
+struct segment_node {
+    struct segment_node* next;
+    // uint8_t segment[] // segment of dynamic size
+};
+
+/**
+ * @brief Simple Shared Memory Region (a.k.a Transactional Memory).
+ */
+struct region {
+    alignas(64) std::atomic<uint64_t> seqlock; // Global sequence lock (odd while a writer commits)
+    alignas(64) void* start;     // Start of the shared memory region (i.e., of the non-deallocable memory segment)
+    size_t size;                 // Size of the non-deallocable memory segment (in bytes)
+    size_t align;                // Size of a word in the shared memory region (in bytes)
+    std::mutex allocs_lock;      // Protects 'allocs'
+    struct segment_node* allocs; // Segments dynamically allocated via tm_alloc
+    struct ebr_domain ebr;       // Reclamation of the segments freed by committed transactions
+};
+
+/**
+ * @brief Logged access to one word, its value being in the transaction's data buffer.
+ */
+struct log_entry {
+    void* addr;    // Accessed word (in the shared region)
+    size_t offset; // Offset of the value in the data buffer
+};
+
+/**
+ * @brief Run of consecutive words read, their values being consecutive in the transaction's data buffer.
+ *
+ * A read extending the last run (the next word, with nothing buffered since)
+ * lengthens it instead of adding an entry, so a sequential scan logs a
+ * single run, validated with a single comparison.
+ */
+struct read_run {
+    void* addr;    // First word read (in the shared region)
+    size_t offset; // Offset of the values in the data buffer
+    size_t size;   // Length of the run (in bytes)
+};
+
+/**
+ * @brief Transaction descriptor, one per thread.
+ */
+struct transaction {
+    bool is_ro;                                   // Whether the transaction is read-only
+    uint64_t snapshot;                            // Value of the sequence lock the reads are consistent with
+    std::vector<struct read_run> reads;           // Read set (value-logged)
+    std::vector<struct log_entry> writes;         // Redo log
+    struct wset index;                            // Word address to redo log entry
+    std::vector<uint8_t> data;                    // Values of the read set and the redo log
+    std::vector<struct segment_node*> allocs;     // Segments allocated by the transaction, to free on abort
+    struct ebr_record* ebr;                       // Record of the thread in the region's reclamation domain
+    std::vector<struct segment_node*> frees;      // Segments freed by the transaction, to retire on commit
+};
+
+static thread_local struct transaction tx_local;
+
+// -------------------------------------------------------------------------- //
+
+/** Hint the processor that we are spin-waiting.
+**/
+static inline void spin_pause() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/** Get the distance between a segment node and its segment, which keeps the segment aligned.
+ * @param region Shared memory region
+ * @return Distance (in bytes)
+**/
+static inline size_t segment_pad(struct region* region) {
+    return region->align < sizeof(struct segment_node) ? sizeof(struct segment_node) : region->align;
+}
+
+/** Get the segment node heading the given segment.
+ * @param region  Shared memory region
+ * @param segment Start address of the segment
+ * @return Segment node
+**/
+static inline struct segment_node* node_of(struct region* region, void* segment) {
+    return (struct segment_node*) ((uintptr_t) segment - segment_pad(region));
+}
+
+/** Abort the given transaction: drop its logs and release its allocations.
+ * @param region Shared memory region
+ * @param tx     Transaction to abort
+**/
+static void tx_abort(struct region* region, struct transaction* tx) {
+    ebr_leave(tx->ebr);
+    if (!tx->allocs.empty()) {
+        std::unique_lock<std::mutex> guard{region->allocs_lock};
+        for (auto sn: tx->allocs) {
+            struct segment_node** link = &(region->allocs);
+            while (*link != sn)
+                link = &((*link)->next);
+            *link = sn->next;
+            free(sn);
+        }
+    }
+}
+
+/** Unlink the segments freed by the given transaction from the region's list, if they are all still in it.
+ * @param region Shared memory region
+ * @param tx     Transaction to commit
+ * @return Whether they were all unlinked (otherwise none is)
+**/
+static bool unlink_frees(struct region* region, struct transaction* tx) {
+    std::unique_lock<std::mutex> guard{region->allocs_lock};
+    for (size_t i = 0; i < tx->frees.size(); ++i) {
+        struct segment_node* sn = tx->frees[i];
+        struct segment_node** link = &(region->allocs);
+        while (*link && *link != sn)
+            link = &((*link)->next);
+        if (!*link) { // Freed by a transaction that committed first: put back the ones unlinked
+            while (i-- > 0) {
+                tx->frees[i]->next = region->allocs;
+                region->allocs = tx->frees[i];
+            }
+            return false;
+        }
+        *link = sn->next;
+    }
+    return true;
+}
+
+/** Wait for an even value of the sequence lock, then check by value that the read set still holds at that time.
+ * @param region Shared memory region
+ * @param tx     Transaction to validate
+ * @return Whether the read set is valid, in which case the snapshot is moved to the new sequence number
+**/
+static bool validate(struct region* region, struct transaction* tx) {
+    while (true) {
+        uint64_t time = region->seqlock.load(std::memory_order_acquire);
+        if (time & 1) {
+            spin_pause();
+            continue;
+        }
+        for (auto& run: tx->reads) {
+            if (memcmp(run.addr, tx->data.data() + run.offset, run.size) != 0)
+                return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (region->seqlock.load(std::memory_order_relaxed) == time) {
+            tx->snapshot = time;
+            return true;
+        }
+    }
+}
+
+/** Read a word in the given transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param source Source word (in the shared region)
+ * @param target Target address (in a private region)
+ * @return Whether the transaction can continue
+**/
+static bool read_word(struct region* region, struct transaction* tx, void const* source, void* target) {
+    size_t align = region->align;
+    if (!tx->writes.empty()) {
+        size_t pos = wset_find(&(tx->index), (uintptr_t) source);
+        if (pos != wset_none) { // Read our own write
+            memcpy(target, tx->data.data() + tx->writes[pos].offset, align);
+            return true;
+        }
+    }
+    memcpy(target, source, align);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    while (region->seqlock.load(std::memory_order_relaxed) != tx->snapshot) {
+        if (!validate(region, tx))
+            return false;
+        memcpy(target, source, align);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    size_t offset = tx->data.size();
+    tx->data.insert(tx->data.end(), (uint8_t const*) target, (uint8_t const*) target + align);
+    if (!tx->reads.empty()) {
+        struct read_run& run = tx->reads.back();
+        if ((uintptr_t) run.addr + run.size == (uintptr_t) source && run.offset + run.size == offset) {
+            run.size += align;
+            return true;
+        }
+    }
+    tx->reads.push_back(read_run{(void*) source, offset, align});
+    return true;
+}
+
+/** Buffer the write of a word in the given transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param source Source address (in a private region)
+ * @param target Target word (in the shared region)
+**/
+static void write_word(struct region* region, struct transaction* tx, void const* source, void* target) {
+    size_t align = region->align;
+    size_t pos = wset_insert(&(tx->index), (uintptr_t) target);
+    if (pos == tx->writes.size()) {
+        tx->writes.push_back(log_entry{target, tx->data.size()});
+        tx->data.resize(tx->data.size() + align);
+    }
+    memcpy(tx->data.data() + tx->writes[pos].offset, source, align);
+}
+
+/** Commit the given read-write transaction, under the sequence lock.
+ * @param region Shared memory region
+ * @param tx     Transaction to commit
+ * @return Whether the transaction committed
+**/
+static bool commit(struct region* region, struct transaction* tx) {
+    uint64_t time = tx->snapshot;
+    while (!region->seqlock.compare_exchange_weak(time, tx->snapshot + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        if (!validate(region, tx))
+            return false;
+        time = tx->snapshot;
+    }
+    // Commits are serialized here, so of two transactions freeing the same
+    // segment (each having read it still allocated), the second one aborts
+    if (!tx->frees.empty() && !unlink_frees(region, tx)) {
+        region->seqlock.store(tx->snapshot, std::memory_order_release); // Nothing written
+        return false;
+    }
+    for (auto& entry: tx->writes)
+        memcpy(entry.addr, tx->data.data() + entry.offset, region->align);
+    region->seqlock.store(tx->snapshot + 2, std::memory_order_release);
+    return true;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
+ * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
+ * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
+ * @return Opaque shared memory region handle, 'invalid_shared' on failure
+**/
+shared_t tm_create(size_t size, size_t align) noexcept {
+    struct region* region = new (std::nothrow) struct region;
+    if (unlikely(!region)) {
+        return invalid_shared;
+    }
+    if (posix_memalign(&(region->start), align < sizeof(void*) ? sizeof(void*) : align, size) != 0) {
+        delete region;
+        return invalid_shared;
+    }
+    memset(region->start, 0, size);
+    region->seqlock.store(0, std::memory_order_relaxed);
+    region->size        = size;
+    region->align       = align;
+    region->allocs      = NULL;
+    ebr_init(&(region->ebr));
+    return region;
+}
+
+/** Destroy (i.e. clean-up + free) a given shared memory region.
+ * @param shared Shared memory region to destroy, with no running transaction
+**/
+void tm_destroy(shared_t shared) noexcept {
+    struct region* region = (struct region*) shared;
+    ebr_destroy(&(region->ebr));
+    struct segment_node* list = region->allocs;
+    while (list) {
+        struct segment_node* tail = list->next;
+        free(list);
+        list = tail;
+    }
+    free(region->start);
+    delete region;
+}
+
+/** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
+ * @param shared Shared memory region to query
+ * @return Start address of the first allocated segment
+**/
+void* tm_start(shared_t shared) noexcept {
+    return ((struct region*) shared)->start;
+}
+
+/** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
+ * @param shared Shared memory region to query
+ * @return First allocated segment size
+**/
+size_t tm_size(shared_t shared) noexcept {
+    return ((struct region*) shared)->size;
+}
+
+/** [thread-safe] Return the alignment (in bytes) of the memory accesses on the given shared memory region.
+ * @param shared Shared memory region to query
+ * @return Alignment used globally
+**/
+size_t tm_align(shared_t shared) noexcept {
+    return ((struct region*) shared)->align;
+}
+
+/** [thread-safe] Begin a new transaction on the given shared memory region.
+ * @param shared Shared memory region to start a transaction on
+ * @param is_ro  Whether the transaction is read-only
+ * @return Opaque transaction ID, 'invalid_tx' on failure
+**/
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* tx = &tx_local;
+    tx->ebr = ebr_record_of(&(region->ebr));
+    if (unlikely(!tx->ebr))
+        return invalid_tx;
+    ebr_enter(&(region->ebr), tx->ebr);
+    tx->is_ro = is_ro;
+    while ((tx->snapshot = region->seqlock.load(std::memory_order_acquire)) & 1)
+        spin_pause();
+    tx->reads.clear();
+    tx->writes.clear();
+    wset_clear(&(tx->index));
+    tx->data.clear();
+    tx->allocs.clear();
+    tx->frees.clear();
+    return (tx_t) tx;
+}
+
+/** [thread-safe] End the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to end
+ * @return Whether the whole transaction committed
+**/
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    if (t->writes.empty() && t->frees.empty()) {
+        // Every read was consistent with the snapshot: nothing to publish
+        ebr_leave(t->ebr);
+        return true;
+    }
+    // The frees commit under the sequence lock too, once the reads validate
+    if (!commit(region, t)) {
+        tx_abort(region, t);
+        return false;
+    }
+    ebr_leave(t->ebr);
+    if (!t->frees.empty()) {
+        // Concurrent transactions may still read a freed segment until they
+        // fail validation, so its memory is only released once they all ended
+        for (auto sn: t->frees)
+            ebr_retire(&(region->ebr), t->ebr, sn, free);
+    }
+    return true;
+}
+
+/** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in the shared region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in a private region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    size_t align = region->align;
+    for (size_t offset = 0; offset < size; offset += align) {
+        if (unlikely(!read_word(region, t, (char const*) source + offset, (char*) target + offset))) {
+            tx_abort(region, t);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in a private region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in the shared region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    size_t align = region->align;
+    for (size_t offset = 0; offset < size; offset += align)
+        write_word(region, t, (char const*) source + offset, (char*) target + offset);
+    return true;
+}
+
+/** [thread-safe] Memory allocation in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param size   Allocation requested size (in bytes), must be a positive multiple of the alignment
+ * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
+ * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
+**/
+Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    // The alignment of the 'next' pointer must be satisfied as well
+    size_t pad = segment_pad(region);
+    struct segment_node* sn;
+    if (unlikely(posix_memalign((void**) &sn, pad, pad + size) != 0))
+        return Alloc::nomem;
+    void* segment = (void*) ((uintptr_t) sn + pad);
+    memset(segment, 0, size);
+    try {
+        t->allocs.push_back(sn);
+    } catch (const std::bad_alloc&) {
+        free(sn);
+        return Alloc::nomem;
+    }
+    {
+        std::unique_lock<std::mutex> guard{region->allocs_lock};
+        sn->next = region->allocs;
+        region->allocs = sn;
+    }
+    *target = segment;
+    return Alloc::success;
+}
+
+/** [thread-safe] Memory freeing in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param target Address of the first byte of the previously allocated segment to deallocate
+ * @return Whether the whole transaction can continue
+**/
+bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
+    ((struct transaction*) tx)->frees.push_back(node_of((struct region*) shared, target));
+    return true;
+}
+
+#ifdef TM_ENGINE
+} // namespace TM_ENGINE
+#endif
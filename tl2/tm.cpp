@@ -0,0 +1,582 @@
+/**
+ * @file   tm.cpp
+ * @author [...]
+ *
+ * @section LICENSE
+ *
+ * [...]
+ *
+ * @section DESCRIPTION
+ *
+ * TL2 transaction manager: a global version clock, a table of versioned
+ * locks striped over the words, read-set validation, a lazy redo log and
+ * commit-time locking.
+ *
+ * A read finding a stripe newer than the read version does not abort right
+ * away: as in LSA, if the read set is still valid, the read version moves to
+ * the current clock (the snapshot is extended) and the read goes on. Every
+ * transaction logs its reads for that, the read-only ones included. The
+ * number of extensions is reported by 'tm_destroy' if 'TM_STATS' is set (and
+ * not "0").
+**/
+
+// Requested features
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define _POSIX_C_SOURCE   200809L
+
+// External headers
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Internal headers
+#include "tm.hpp"
+
+#include "macros.h"
+#include "ebr.hpp"
+#include "validate.hpp"
+#include "wset.hpp"
+
+#ifdef TM_ENGINE
+// Built into another library, behind its dispatch table (see 376166/dispatch.cpp)
+namespace TM_ENGINE {
+#endif
+
+/**
+ * @brief Versioned lock encoding.
+ *
+ * The least significant bit tells whether the lock is taken, the other bits
+ * hold the commit timestamp of the last write to any word of the stripe. A
+ * taken lock keeps its version, so that a committing transaction can still
+ * validate the stripes it locked itself.
+ */
+static const uint64_t lock_bit = 1;
+
+static const size_t lock_stripes = (size_t) 1 << 20; // Number of versioned locks (a power of 2)
+
+/**
+ * @brief Allocated segment, in a list for 'tm_destroy'.
+ */
+struct segment_node {
+    struct segment_node* next;
+    // uint8_t segment[] // segment of dynamic size
+};
+
+/**
+ * @brief Simple Shared Memory Region (a.k.a Transactional Memory).
+ */
+struct region {
+    alignas(64) std::atomic<uint64_t> clock; // Global version clock
+    alignas(64) std::atomic<uint64_t>* locks; // Versioned lock table
+    void* start;                 // Start of the shared memory region (i.e., of the non-deallocable memory segment)
+    size_t size;                 // Size of the non-deallocable memory segment (in bytes)
+    size_t align;                // Size of a word in the shared memory region (in bytes)
+    size_t align_shift;          // Binary logarithm of 'align'
+    std::mutex allocs_lock;      // Protects 'allocs'
+    struct segment_node* allocs; // Segments dynamically allocated via tm_alloc
+    struct ebr_domain ebr;       // Reclamation of the segments freed by committed transactions
+    std::atomic<uint64_t> extensions; // Snapshot extensions of the ended transactions
+    std::atomic<uint64_t> extended;   // Ended transactions that extended their snapshot
+    std::atomic<uint64_t> most;       // Most snapshot extensions of one transaction
+    bool stats;                  // Whether to print the snapshot extensions in 'tm_destroy'
+};
+
+/**
+ * @brief Buffered write of one word.
+ */
+struct write_entry {
+    void* target;                 // Target word (in the shared region)
+    std::atomic<uint64_t>* lock;  // Versioned lock of the stripe
+    size_t offset;                // Offset of the buffered value in the transaction's data buffer
+};
+
+/**
+ * @brief Run of consecutive versioned locks read.
+ *
+ * Consecutive words map to consecutive stripes, so a sequential scan logs a
+ * single run rather than one lock per word.
+ */
+struct read_run {
+    std::atomic<uint64_t>* first; // First lock of the run
+    size_t count;                 // Number of locks in the run
+};
+
+/**
+ * @brief Transaction descriptor, one per thread.
+ */
+struct transaction {
+    bool is_ro;                                       // Whether the transaction is read-only
+    uint64_t rv;                                      // Read version (snapshot of the clock at begin, or at the last extension)
+    uint64_t extensions;                              // Number of snapshot extensions
+    std::vector<struct read_run> reads;               // Versioned locks of the read stripes (read-only transactions included, to extend the snapshot)
+    std::vector<struct write_entry> writes;           // Redo log
+    struct wset index;                                // Word address to redo log entry
+    std::vector<uint8_t> data;                        // Buffered values of the redo log
+    std::vector<std::atomic<uint64_t>*> locked;       // Stripes locked at commit (sorted, unique)
+    std::vector<struct segment_node*> allocs;         // Segments allocated by the transaction, to free on abort
+    struct ebr_record* ebr;                           // Record of the thread in the region's reclamation domain
+    std::vector<struct segment_node*> frees;          // Segments freed by the transaction, to retire on commit
+};
+
+static thread_local struct transaction tx_local;
+
+// -------------------------------------------------------------------------- //
+
+/** Get the versioned lock of the stripe holding the given word.
+ * @param region Shared memory region
+ * @param addr   Address of the word
+ * @return Versioned lock of the stripe
+**/
+static inline std::atomic<uint64_t>* stripe_of(struct region* region, void const* addr) {
+    return &(region->locks[((uintptr_t) addr >> region->align_shift) & (lock_stripes - 1)]);
+}
+
+/** Get the distance between a segment node and its segment, which keeps the segment aligned.
+ * @param region Shared memory region
+ * @return Distance (in bytes)
+**/
+static inline size_t segment_pad(struct region* region) {
+    return region->align < sizeof(struct segment_node) ? sizeof(struct segment_node) : region->align;
+}
+
+/** Get the segment node heading the given segment.
+ * @param region  Shared memory region
+ * @param segment Start address of the segment
+ * @return Segment node
+**/
+static inline struct segment_node* node_of(struct region* region, void* segment) {
+    return (struct segment_node*) ((uintptr_t) segment - segment_pad(region));
+}
+
+/** Release the locks taken at commit.
+ * @param tx      Transaction holding the locks
+ * @param version Version to release the locks with, or '0' to restore their version
+**/
+static void release_locks(struct transaction* tx, uint64_t version) {
+    for (auto lock: tx->locked) {
+        uint64_t value = version ? version << 1 : lock->load(std::memory_order_relaxed) & ~lock_bit;
+        lock->store(value, std::memory_order_release);
+    }
+    tx->locked.clear();
+}
+
+/** Leave the running transaction, accounting for its snapshot extensions.
+ * @param region Shared memory region
+ * @param tx     Transaction to leave
+**/
+static void tx_leave(struct region* region, struct transaction* tx) {
+    ebr_leave(tx->ebr);
+    if (unlikely(tx->extensions != 0) && region->stats) {
+        region->extensions.fetch_add(tx->extensions, std::memory_order_relaxed);
+        region->extended.fetch_add(1, std::memory_order_relaxed);
+        uint64_t most = region->most.load(std::memory_order_relaxed);
+        while (most < tx->extensions && !region->most.compare_exchange_weak(most, tx->extensions, std::memory_order_relaxed));
+    }
+}
+
+/** Abort the given transaction: drop its logs and release its allocations.
+ * @param region Shared memory region
+ * @param tx     Transaction to abort
+**/
+static void tx_abort(struct region* region, struct transaction* tx) {
+    tx_leave(region, tx);
+    if (!tx->allocs.empty()) {
+        std::unique_lock<std::mutex> guard{region->allocs_lock};
+        for (auto sn: tx->allocs) {
+            struct segment_node** link = &(region->allocs);
+            while (*link != sn)
+                link = &((*link)->next);
+            *link = sn->next;
+            free(sn);
+        }
+    }
+}
+
+/** Unlink the segments freed by the given transaction from the region's list, if they are all still in it.
+ * @param region Shared memory region
+ * @param tx     Transaction to commit
+ * @return Whether they were all unlinked (otherwise none is)
+**/
+static bool unlink_frees(struct region* region, struct transaction* tx) {
+    std::unique_lock<std::mutex> guard{region->allocs_lock};
+    for (size_t i = 0; i < tx->frees.size(); ++i) {
+        struct segment_node* sn = tx->frees[i];
+        struct segment_node** link = &(region->allocs);
+        while (*link && *link != sn)
+            link = &((*link)->next);
+        if (!*link) { // Freed by a transaction that committed first: put back the ones unlinked
+            while (i-- > 0) {
+                tx->frees[i]->next = region->allocs;
+                region->allocs = tx->frees[i];
+            }
+            return false;
+        }
+        *link = sn->next;
+    }
+    return true;
+}
+
+/** Check that every read stripe is still at a version no later than the read version.
+ * @param tx Transaction to validate, holding its commit locks
+ * @return Whether the read set is still valid
+**/
+static bool validate(struct transaction* tx) {
+    for (auto& run: tx->reads) {
+        // The kernel stops at the locked stripes, which may be ours
+        for (size_t i = 0; (i += validate_words(run.first + i, run.count - i, 1, lock_bit, tx->rv << 1)) < run.count; ++i) {
+            std::atomic<uint64_t>* lock = run.first + i;
+            uint64_t value = lock->load(std::memory_order_acquire);
+            if ((value >> 1) > tx->rv)
+                return false;
+            if ((value & lock_bit) && !std::binary_search(tx->locked.begin(), tx->locked.end(), lock))
+                return false;
+        }
+    }
+    return true;
+}
+
+/** Extend the snapshot of the given transaction to the current clock, if its read set is still valid at its read version.
+ * @param region Shared memory region
+ * @param tx     Transaction to extend, holding no commit lock
+ * @return Whether the snapshot was extended
+**/
+static bool extend(struct region* region, struct transaction* tx) {
+    // A commit timestamped up to 'now' locked its stripes before taking it,
+    // so the validation sees them locked or at their new version
+    uint64_t now = region->clock.load(std::memory_order_acquire);
+    if (!validate(tx))
+        return false;
+    tx->rv = now;
+    ++tx->extensions;
+    return true;
+}
+
+/** Add a read stripe to the read set, extending the last run if it follows it.
+ * @param tx   Transaction to use
+ * @param lock Versioned lock of the stripe
+**/
+static inline void log_read(struct transaction* tx, std::atomic<uint64_t>* lock) {
+    if (!tx->reads.empty()) {
+        struct read_run& run = tx->reads.back();
+        if (lock == run.first + run.count) {
+            ++run.count;
+            return;
+        }
+        if (lock == run.first + run.count - 1) // Stripe read last already
+            return;
+    }
+    tx->reads.push_back(read_run{lock, 1});
+}
+
+/** Read a word in the given transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param source Source word (in the shared region)
+ * @param target Target address (in a private region)
+ * @return Whether the transaction can continue
+**/
+static bool read_word(struct region* region, struct transaction* tx, void const* source, void* target) {
+    size_t align = region->align;
+    if (!tx->is_ro && !tx->writes.empty()) {
+        size_t pos = wset_find(&(tx->index), (uintptr_t) source);
+        if (pos != wset_none) { // Read our own write
+            memcpy(target, tx->data.data() + tx->writes[pos].offset, align);
+            return true;
+        }
+    }
+    std::atomic<uint64_t>* lock = stripe_of(region, source);
+    uint64_t before = lock->load(std::memory_order_acquire);
+    while (unlikely((before >> 1) > tx->rv) && !(before & lock_bit)) {
+        if (!extend(region, tx))
+            return false;
+        before = lock->load(std::memory_order_acquire);
+    }
+    if (before & lock_bit)
+        return false;
+    memcpy(target, source, align);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (lock->load(std::memory_order_relaxed) != before)
+        return false;
+    log_read(tx, lock);
+    return true;
+}
+
+/** Buffer the write of a word in the given transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to use
+ * @param source Source address (in a private region)
+ * @param target Target word (in the shared region)
+**/
+static void write_word(struct region* region, struct transaction* tx, void const* source, void* target) {
+    size_t align = region->align;
+    size_t pos = wset_insert(&(tx->index), (uintptr_t) target);
+    if (pos == tx->writes.size()) {
+        tx->writes.push_back(write_entry{target, stripe_of(region, target), tx->data.size()});
+        tx->data.resize(tx->data.size() + align);
+    }
+    memcpy(tx->data.data() + tx->writes[pos].offset, source, align);
+}
+
+/** Commit the given read-write transaction.
+ * @param region Shared memory region
+ * @param tx     Transaction to commit
+ * @return Whether the transaction committed
+**/
+static bool commit(struct region* region, struct transaction* tx) {
+    // Lock the written stripes, in address order
+    for (auto& entry: tx->writes)
+        tx->locked.push_back(entry.lock);
+    std::sort(tx->locked.begin(), tx->locked.end());
+    tx->locked.erase(std::unique(tx->locked.begin(), tx->locked.end()), tx->locked.end());
+    for (size_t i = 0; i < tx->locked.size(); ++i) {
+        std::atomic<uint64_t>* lock = tx->locked[i];
+        uint64_t value = lock->load(std::memory_order_relaxed);
+        if ((value & lock_bit) || !lock->compare_exchange_strong(value, value | lock_bit, std::memory_order_acquire)) {
+            tx->locked.resize(i);
+            release_locks(tx, 0);
+            return false;
+        }
+    }
+    // Take the write version, and validate the read set unless no one committed since we began
+    uint64_t wv = region->clock.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (wv != tx->rv + 1 && !validate(tx)) {
+        release_locks(tx, 0);
+        return false;
+    }
+    // Of two transactions freeing the same segment (each having read it still
+    // allocated), the one unlinking it second aborts
+    if (!tx->frees.empty() && !unlink_frees(region, tx)) {
+        release_locks(tx, 0);
+        return false;
+    }
+    // Write back, and release the locks with the write version
+    for (auto& entry: tx->writes)
+        memcpy(entry.target, tx->data.data() + entry.offset, region->align);
+    release_locks(tx, wv);
+    return true;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
+ * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
+ * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
+ * @return Opaque shared memory region handle, 'invalid_shared' on failure
+**/
+shared_t tm_create(size_t size, size_t align) noexcept {
+    struct region* region = new (std::nothrow) struct region;
+    if (unlikely(!region)) {
+        return invalid_shared;
+    }
+    if (posix_memalign(&(region->start), align < sizeof(void*) ? sizeof(void*) : align, size) != 0) {
+        delete region;
+        return invalid_shared;
+    }
+    // Zero-filled pages from 'calloc' are a valid table of unlocked stripes at version 0
+    region->locks = (std::atomic<uint64_t>*) calloc(lock_stripes, sizeof(std::atomic<uint64_t>));
+    if (unlikely(!region->locks)) {
+        free(region->start);
+        delete region;
+        return invalid_shared;
+    }
+    memset(region->start, 0, size);
+    region->clock.store(0, std::memory_order_relaxed);
+    region->size        = size;
+    region->align       = align;
+    region->align_shift = __builtin_ctzl(align);
+    region->allocs      = NULL;
+    region->extensions.store(0, std::memory_order_relaxed);
+    region->extended.store(0, std::memory_order_relaxed);
+    region->most.store(0, std::memory_order_relaxed);
+    char const* env = getenv("TM_STATS");
+    region->stats       = env && env[0] != '\0' && strcmp(env, "0") != 0;
+    ebr_init(&(region->ebr));
+    return region;
+}
+
+/** Destroy (i.e. clean-up + free) a given shared memory region.
+ * @param shared Shared memory region to destroy, with no running transaction
+**/
+void tm_destroy(shared_t shared) noexcept {
+    struct region* region = (struct region*) shared;
+    if (region->stats)
+        fprintf(stderr, "tl2: %lu snapshot extensions, in %lu transactions, at most %lu in one\n", (unsigned long) region->extensions.load(std::memory_order_relaxed), (unsigned long) region->extended.load(std::memory_order_relaxed), (unsigned long) region->most.load(std::memory_order_relaxed));
+    ebr_destroy(&(region->ebr));
+    struct segment_node* list = region->allocs;
+    while (list) {
+        struct segment_node* tail = list->next;
+        free(list);
+        list = tail;
+    }
+    free(region->locks);
+    free(region->start);
+    delete region;
+}
+
+/** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
+ * @param shared Shared memory region to query
+ * @return Start address of the first allocated segment
+**/
+void* tm_start(shared_t shared) noexcept {
+    return ((struct region*) shared)->start;
+}
+
+/** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
+ * @param shared Shared memory region to query
+ * @return First allocated segment size
+**/
+size_t tm_size(shared_t shared) noexcept {
+    return ((struct region*) shared)->size;
+}
+
+/** [thread-safe] Return the alignment (in bytes) of the memory accesses on the given shared memory region.
+ * @param shared Shared memory region to query
+ * @return Alignment used globally
+**/
+size_t tm_align(shared_t shared) noexcept {
+    return ((struct region*) shared)->align;
+}
+
+/** [thread-safe] Begin a new transaction on the given shared memory region.
+ * @param shared Shared memory region to start a transaction on
+ * @param is_ro  Whether the transaction is read-only
+ * @return Opaque transaction ID, 'invalid_tx' on failure
+**/
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* tx = &tx_local;
+    tx->ebr = ebr_record_of(&(region->ebr));
+    if (unlikely(!tx->ebr))
+        return invalid_tx;
+    ebr_enter(&(region->ebr), tx->ebr);
+    tx->is_ro = is_ro;
+    tx->rv = region->clock.load(std::memory_order_acquire);
+    tx->extensions = 0;
+    tx->reads.clear();
+    tx->writes.clear();
+    wset_clear(&(tx->index));
+    tx->data.clear();
+    tx->allocs.clear();
+    tx->frees.clear();
+    return (tx_t) tx;
+}
+
+/** [thread-safe] End the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to end
+ * @return Whether the whole transaction committed
+**/
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    if (t->is_ro || (t->writes.empty() && t->frees.empty())) {
+        // Every read was of a stripe up to the read version: nothing to publish
+        tx_leave(region, t);
+        return true;
+    }
+    // The frees take a write version too, once the reads validate
+    if (!commit(region, t)) {
+        tx_abort(region, t);
+        return false;
+    }
+    tx_leave(region, t);
+    if (!t->frees.empty()) {
+        // Concurrent transactions may still read a freed segment until they
+        // fail validation, so its memory is only released once they all ended
+        for (auto sn: t->frees)
+            ebr_retire(&(region->ebr), t->ebr, sn, free);
+    }
+    return true;
+}
+
+/** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in the shared region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in a private region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    size_t align = region->align;
+    for (size_t offset = 0; offset < size; offset += align) {
+        if (unlikely(!read_word(region, t, (char const*) source + offset, (char*) target + offset))) {
+            tx_abort(region, t);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in a private region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in the shared region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    size_t align = region->align;
+    for (size_t offset = 0; offset < size; offset += align)
+        write_word(region, t, (char const*) source + offset, (char*) target + offset);
+    return true;
+}
+
+/** [thread-safe] Memory allocation in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param size   Allocation requested size (in bytes), must be a positive multiple of the alignment
+ * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
+ * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
+**/
+Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
+    struct region* region = (struct region*) shared;
+    struct transaction* t = (struct transaction*) tx;
+    // The alignment of the 'next' pointer must be satisfied as well
+    size_t pad = segment_pad(region);
+    struct segment_node* sn;
+    if (unlikely(posix_memalign((void**) &sn, pad, pad + size) != 0))
+        return Alloc::nomem;
+    void* segment = (void*) ((uintptr_t) sn + pad);
+    memset(segment, 0, size);
+    try {
+        t->allocs.push_back(sn);
+    } catch (const std::bad_alloc&) {
+        free(sn);
+        return Alloc::nomem;
+    }
+    {
+        std::unique_lock<std::mutex> guard{region->allocs_lock};
+        sn->next = region->allocs;
+        region->allocs = sn;
+    }
+    *target = segment;
+    return Alloc::success;
+}
+
+/** [thread-safe] Memory freeing in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param target Address of the first byte of the previously allocated segment to deallocate
+ * @return Whether the whole transaction can continue
+**/
+bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
+    ((struct transaction*) tx)->frees.push_back(node_of((struct region*) shared, target));
+    return true;
+}
+
+#ifdef TM_ENGINE
+} // namespace TM_ENGINE
+#endif